@@ -0,0 +1,315 @@
+/* classes.h: written by gen_classes, do not edit
+ *
+ * For the order FIB_K and the size of a pointer, CLASS_SIZES are the
+ * CLASS_COUNT classes in blocks, the first of at least CLASS_MIN_SIZE,
+ * and CLASS_LOG_INDEX gives the first class of at least 2 to the power
+ * f, for f below CLASS_LOG_COUNT.  The threads cache the CLASS_CACHE_COUNT
+ * first classes, up to the one of CLASS_CACHE_MAX blocks.
+ */
+
+#if FIB_K == 1
+
+#if SIZE_MAX > 0xffffffff
+#define CLASS_MIN_SIZE 3
+#define CLASS_COUNT 57
+#define CLASS_SIZES \
+    4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, \
+    32768, 65536, 131072, 262144, 524288, 1048576, 2097152, 4194304, \
+    8388608, 16777216, 33554432, 67108864, 134217728, 268435456, \
+    536870912, 1073741824, 2147483648, 4294967296, 8589934592, \
+    17179869184, 34359738368, 68719476736, 137438953472, 274877906944, \
+    549755813888, 1099511627776, 2199023255552, 4398046511104, \
+    8796093022208, 17592186044416, 35184372088832, 70368744177664, \
+    140737488355328, 281474976710656, 562949953421312, 1125899906842624, \
+    2251799813685248, 4503599627370496, 9007199254740992, \
+    18014398509481984, 36028797018963968, 72057594037927936, \
+    144115188075855872, 288230376151711744
+#define CLASS_LOG_COUNT 59
+#define CLASS_LOG_INDEX \
+    0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, \
+    18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, \
+    35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, \
+    52, 53, 54, 55, 56
+#define CLASS_CACHE_COUNT 6
+#define CLASS_CACHE_MAX 128
+#elif SIZE_MAX > 0xffff
+#define CLASS_MIN_SIZE 2
+#define CLASS_COUNT 26
+#define CLASS_SIZES \
+    2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, \
+    32768, 65536, 131072, 262144, 524288, 1048576, 2097152, 4194304, \
+    8388608, 16777216, 33554432, 67108864
+#define CLASS_LOG_COUNT 27
+#define CLASS_LOG_INDEX \
+    0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, \
+    19, 20, 21, 22, 23, 24, 25
+#define CLASS_CACHE_COUNT 6
+#define CLASS_CACHE_MAX 64
+#else
+#define CLASS_MIN_SIZE 1
+#define CLASS_COUNT 11
+#define CLASS_SIZES \
+    1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024
+#define CLASS_LOG_COUNT 11
+#define CLASS_LOG_INDEX \
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10
+#define CLASS_CACHE_COUNT 6
+#define CLASS_CACHE_MAX 32
+#endif
+
+#elif FIB_K == 2
+
+#if SIZE_MAX > 0xffffffff
+#define CLASS_MIN_SIZE 3
+#define CLASS_COUNT 83
+#define CLASS_SIZES \
+    3, 5, 8, 13, 21, 34, 55, 89, 144, 233, 377, 610, 987, 1597, 2584, \
+    4181, 6765, 10946, 17711, 28657, 46368, 75025, 121393, 196418, \
+    317811, 514229, 832040, 1346269, 2178309, 3524578, 5702887, 9227465, \
+    14930352, 24157817, 39088169, 63245986, 102334155, 165580141, \
+    267914296, 433494437, 701408733, 1134903170, 1836311903, 2971215073, \
+    4807526976, 7778742049, 12586269025, 20365011074, 32951280099, \
+    53316291173, 86267571272, 139583862445, 225851433717, 365435296162, \
+    591286729879, 956722026041, 1548008755920, 2504730781961, \
+    4052739537881, 6557470319842, 10610209857723, 17167680177565, \
+    27777890035288, 44945570212853, 72723460248141, 117669030460994, \
+    190392490709135, 308061521170129, 498454011879264, 806515533049393, \
+    1304969544928657, 2111485077978050, 3416454622906707, \
+    5527939700884757, 8944394323791464, 14472334024676221, \
+    23416728348467685, 37889062373143906, 61305790721611591, \
+    99194853094755497, 160500643816367088, 259695496911122585, \
+    420196140727489673
+#define CLASS_LOG_COUNT 59
+#define CLASS_LOG_INDEX \
+    0, 0, 1, 2, 4, 5, 7, 8, 10, 11, 13, 14, 15, 17, 18, 20, 21, 23, 24, \
+    26, 27, 28, 30, 31, 33, 34, 36, 37, 39, 40, 41, 43, 44, 46, 47, 49, \
+    50, 51, 53, 54, 56, 57, 59, 60, 62, 63, 64, 66, 67, 69, 70, 72, 73, \
+    75, 76, 77, 79, 80, 82
+#define CLASS_CACHE_COUNT 8
+#define CLASS_CACHE_MAX 89
+#elif SIZE_MAX > 0xffff
+#define CLASS_MIN_SIZE 2
+#define CLASS_COUNT 38
+#define CLASS_SIZES \
+    2, 3, 5, 8, 13, 21, 34, 55, 89, 144, 233, 377, 610, 987, 1597, 2584, \
+    4181, 6765, 10946, 17711, 28657, 46368, 75025, 121393, 196418, \
+    317811, 514229, 832040, 1346269, 2178309, 3524578, 5702887, 9227465, \
+    14930352, 24157817, 39088169, 63245986, 102334155
+#define CLASS_LOG_COUNT 27
+#define CLASS_LOG_INDEX \
+    0, 0, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 16, 18, 19, 21, 22, 24, 25, \
+    27, 28, 29, 31, 32, 34, 35, 37
+#define CLASS_CACHE_COUNT 7
+#define CLASS_CACHE_MAX 34
+#else
+#define CLASS_MIN_SIZE 1
+#define CLASS_COUNT 16
+#define CLASS_SIZES \
+    1, 2, 3, 5, 8, 13, 21, 34, 55, 89, 144, 233, 377, 610, 987, 1597
+#define CLASS_LOG_COUNT 11
+#define CLASS_LOG_INDEX \
+    0, 1, 3, 4, 6, 7, 9, 10, 12, 13, 15
+#define CLASS_CACHE_COUNT 7
+#define CLASS_CACHE_MAX 21
+#endif
+
+#elif FIB_K == 3
+
+#if SIZE_MAX > 0xffffffff
+#define CLASS_MIN_SIZE 3
+#define CLASS_COUNT 105
+#define CLASS_SIZES \
+    3, 4, 6, 9, 13, 19, 28, 41, 60, 88, 129, 189, 277, 406, 595, 872, \
+    1278, 1873, 2745, 4023, 5896, 8641, 12664, 18560, 27201, 39865, \
+    58425, 85626, 125491, 183916, 269542, 395033, 578949, 848491, \
+    1243524, 1822473, 2670964, 3914488, 5736961, 8407925, 12322413, \
+    18059374, 26467299, 38789712, 56849086, 83316385, 122106097, \
+    178955183, 262271568, 384377665, 563332848, 825604416, 1209982081, \
+    1773314929, 2598919345, 3808901426, 5582216355, 8181135700, \
+    11990037126, 17572253481, 25753389181, 37743426307, 55315679788, \
+    81069068969, 118812495276, 174128175064, 255197244033, 374009739309, \
+    548137914373, 803335158406, 1177344897715, 1725482812088, \
+    2528817970494, 3706162868209, 5431645680297, 7960463650791, \
+    11666626519000, 17098272199297, 25058735850088, 36725362369088, \
+    53823634568385, 78882370418473, 115607732787561, 169431367355946, \
+    248313737774419, 363921470561980, 533352837917926, 781666575692345, \
+    1145588046254325, 1678940884172251, 2460607459864596, \
+    3606195506118921, 5285136390291172, 7745743850155768, \
+    11351939356274689, 16637075746565861, 24382819596721629, \
+    35734758952996318, 52371834699562179, 76754654296283808, \
+    112489413249280126, 164861247948842305, 241615902245126113, \
+    354105315494406239, 518966563443248544
+#define CLASS_LOG_COUNT 59
+#define CLASS_LOG_INDEX \
+    0, 0, 1, 3, 5, 7, 9, 10, 12, 14, 16, 18, 20, 21, 23, 25, 27, 29, 30, \
+    32, 34, 36, 38, 39, 41, 43, 45, 47, 49, 50, 52, 54, 56, 58, 59, 61, \
+    63, 65, 67, 69, 70, 72, 74, 76, 78, 79, 81, 83, 85, 87, 88, 90, 92, \
+    94, 96, 98, 99, 101, 103
+#define CLASS_CACHE_COUNT 10
+#define CLASS_CACHE_MAX 88
+#elif SIZE_MAX > 0xffff
+#define CLASS_MIN_SIZE 2
+#define CLASS_COUNT 48
+#define CLASS_SIZES \
+    2, 3, 4, 6, 9, 13, 19, 28, 41, 60, 88, 129, 189, 277, 406, 595, 872, \
+    1278, 1873, 2745, 4023, 5896, 8641, 12664, 18560, 27201, 39865, \
+    58425, 85626, 125491, 183916, 269542, 395033, 578949, 848491, \
+    1243524, 1822473, 2670964, 3914488, 5736961, 8407925, 12322413, \
+    18059374, 26467299, 38789712, 56849086, 83316385, 122106097
+#define CLASS_LOG_COUNT 27
+#define CLASS_LOG_INDEX \
+    0, 0, 2, 4, 6, 8, 10, 11, 13, 15, 17, 19, 21, 22, 24, 26, 28, 30, \
+    31, 33, 35, 37, 39, 40, 42, 44, 46
+#define CLASS_CACHE_COUNT 9
+#define CLASS_CACHE_MAX 41
+#else
+#define CLASS_MIN_SIZE 1
+#define CLASS_COUNT 20
+#define CLASS_SIZES \
+    1, 2, 3, 4, 6, 9, 13, 19, 28, 41, 60, 88, 129, 189, 277, 406, 595, \
+    872, 1278, 1873
+#define CLASS_LOG_COUNT 11
+#define CLASS_LOG_INDEX \
+    0, 1, 3, 5, 7, 9, 11, 12, 14, 16, 18
+#define CLASS_CACHE_COUNT 8
+#define CLASS_CACHE_MAX 19
+#endif
+
+#elif FIB_K == 4
+
+#if SIZE_MAX > 0xffffffff
+#define CLASS_MIN_SIZE 3
+#define CLASS_COUNT 124
+#define CLASS_SIZES \
+    3, 4, 5, 7, 10, 14, 19, 26, 36, 50, 69, 95, 131, 181, 250, 345, 476, \
+    657, 907, 1252, 1728, 2385, 3292, 4544, 6272, 8657, 11949, 16493, \
+    22765, 31422, 43371, 59864, 82629, 114051, 157422, 217286, 299915, \
+    413966, 571388, 788674, 1088589, 1502555, 2073943, 2862617, 3951206, \
+    5453761, 7527704, 10390321, 14341527, 19795288, 27322992, 37713313, \
+    52054840, 71850128, 99173120, 136886433, 188941273, 260791401, \
+    359964521, 496850954, 685792227, 946583628, 1306548149, 1803399103, \
+    2489191330, 3435774958, 4742323107, 6545722210, 9034913540, \
+    12470688498, 17213011605, 23758733815, 32793647355, 45264335853, \
+    62477347458, 86236081273, 119029728628, 164294064481, 226771411939, \
+    313007493212, 432037221840, 596331286321, 823102698260, \
+    1136110191472, 1568147413312, 2164478699633, 2987581397893, \
+    4123691589365, 5691839002677, 7856317702310, 10843899100203, \
+    14967590689568, 20659429692245, 28515747394555, 39359646494758, \
+    54327237184326, 74986666876571, 103502414271126, 142862060765884, \
+    197189297950210, 272175964826781, 375678379097907, 518540439863791, \
+    715729737814001, 987905702640782, 1363584081738689, \
+    1882124521602480, 2597854259416481, 3585759962057263, \
+    4949344043795952, 6831468565398432, 9429322824814913, \
+    13015082786872176, 17964426830668128, 24795895396066560, \
+    34225218220881473, 47240301007753649, 65204727838421777, \
+    90000623234488337, 124225841455369810, 171466142463123459, \
+    236670870301545236, 326671493536033573, 450897334991403383
+#define CLASS_LOG_COUNT 59
+#define CLASS_LOG_INDEX \
+    0, 0, 1, 4, 6, 8, 10, 12, 15, 17, 19, 21, 23, 25, 27, 30, 32, 34, \
+    36, 38, 40, 43, 45, 47, 49, 51, 53, 55, 58, 60, 62, 64, 66, 68, 70, \
+    73, 75, 77, 79, 81, 83, 86, 88, 90, 92, 94, 96, 98, 101, 103, 105, \
+    107, 109, 111, 114, 116, 118, 120, 122
+#define CLASS_CACHE_COUNT 11
+#define CLASS_CACHE_MAX 69
+#elif SIZE_MAX > 0xffff
+#define CLASS_MIN_SIZE 2
+#define CLASS_COUNT 56
+#define CLASS_SIZES \
+    2, 3, 4, 5, 7, 10, 14, 19, 26, 36, 50, 69, 95, 131, 181, 250, 345, \
+    476, 657, 907, 1252, 1728, 2385, 3292, 4544, 6272, 8657, 11949, \
+    16493, 22765, 31422, 43371, 59864, 82629, 114051, 157422, 217286, \
+    299915, 413966, 571388, 788674, 1088589, 1502555, 2073943, 2862617, \
+    3951206, 5453761, 7527704, 10390321, 14341527, 19795288, 27322992, \
+    37713313, 52054840, 71850128, 99173120
+#define CLASS_LOG_COUNT 27
+#define CLASS_LOG_INDEX \
+    0, 0, 2, 5, 7, 9, 11, 13, 16, 18, 20, 22, 24, 26, 28, 31, 33, 35, \
+    37, 39, 41, 44, 46, 48, 50, 52, 54
+#define CLASS_CACHE_COUNT 10
+#define CLASS_CACHE_MAX 36
+#else
+#define CLASS_MIN_SIZE 1
+#define CLASS_COUNT 23
+#define CLASS_SIZES \
+    1, 2, 3, 4, 5, 7, 10, 14, 19, 26, 36, 50, 69, 95, 131, 181, 250, \
+    345, 476, 657, 907, 1252, 1728
+#define CLASS_LOG_COUNT 11
+#define CLASS_LOG_INDEX \
+    0, 1, 3, 6, 8, 10, 12, 14, 17, 19, 21
+#define CLASS_CACHE_COUNT 9
+#define CLASS_CACHE_MAX 19
+#endif
+
+#elif FIB_K == 5
+
+#if SIZE_MAX > 0xffffffff
+#define CLASS_MIN_SIZE 3
+#define CLASS_COUNT 142
+#define CLASS_SIZES \
+    3, 4, 5, 6, 8, 11, 15, 20, 26, 34, 45, 60, 80, 106, 140, 185, 245, \
+    325, 431, 571, 756, 1001, 1326, 1757, 2328, 3084, 4085, 5411, 7168, \
+    9496, 12580, 16665, 22076, 29244, 38740, 51320, 67985, 90061, \
+    119305, 158045, 209365, 277350, 367411, 486716, 644761, 854126, \
+    1131476, 1498887, 1985603, 2630364, 3484490, 4615966, 6114853, \
+    8100456, 10730820, 14215310, 18831276, 24946129, 33046585, 43777405, \
+    57992715, 76823991, 101770120, 134816705, 178594110, 236586825, \
+    313410816, 415180936, 549997641, 728591751, 965178576, 1278589392, \
+    1693770328, 2243767969, 2972359720, 3937538296, 5216127688, \
+    6909898016, 9153665985, 12126025705, 16063564001, 21279691689, \
+    28189589705, 37343255690, 49469281395, 65532845396, 86812537085, \
+    115002126790, 152345382480, 201814663875, 267347509271, \
+    354160046356, 469162173146, 621507555626, 823322219501, \
+    1090669728772, 1444829775128, 1913991948274, 2535499503900, \
+    3358821723401, 4449491452173, 5894321227301, 7808313175575, \
+    10343812679475, 13702634402876, 18152125855049, 24046447082350, \
+    31854760257925, 42198572937400, 55901207340276, 74053333195325, \
+    98099780277675, 129954540535600, 172153113473000, 228054320813276, \
+    302107654008601, 400207434286276, 530161974821876, 702315088294876, \
+    930369409108152, 1232477063116753, 1632684497403029, \
+    2162846472224905, 2865161560519781, 3795530969627933, \
+    5028008032744686, 6660692530147715, 8823539002372620, \
+    11688700562892401, 15484231532520334, 20512239565265020, \
+    27172932095412735, 35996471097785355, 47685171660677756, \
+    63169403193198090, 83681642758463110, 110854574853875845, \
+    146851045951661200, 194536217612338956, 257705620805537046, \
+    341387263564000156, 452241838417876001
+#define CLASS_LOG_COUNT 59
+#define CLASS_LOG_INDEX \
+    0, 0, 1, 4, 7, 9, 12, 14, 17, 19, 22, 24, 27, 29, 31, 34, 36, 39, \
+    41, 44, 46, 49, 51, 54, 56, 59, 61, 63, 66, 68, 71, 73, 76, 78, 81, \
+    83, 86, 88, 91, 93, 96, 98, 100, 103, 105, 108, 110, 113, 115, 118, \
+    120, 123, 125, 128, 130, 133, 135, 137, 140
+#define CLASS_CACHE_COUNT 13
+#define CLASS_CACHE_MAX 80
+#elif SIZE_MAX > 0xffff
+#define CLASS_MIN_SIZE 2
+#define CLASS_COUNT 64
+#define CLASS_SIZES \
+    2, 3, 4, 5, 6, 8, 11, 15, 20, 26, 34, 45, 60, 80, 106, 140, 185, \
+    245, 325, 431, 571, 756, 1001, 1326, 1757, 2328, 3084, 4085, 5411, \
+    7168, 9496, 12580, 16665, 22076, 29244, 38740, 51320, 67985, 90061, \
+    119305, 158045, 209365, 277350, 367411, 486716, 644761, 854126, \
+    1131476, 1498887, 1985603, 2630364, 3484490, 4615966, 6114853, \
+    8100456, 10730820, 14215310, 18831276, 24946129, 33046585, 43777405, \
+    57992715, 76823991, 101770120
+#define CLASS_LOG_COUNT 27
+#define CLASS_LOG_INDEX \
+    0, 0, 2, 5, 8, 10, 13, 15, 18, 20, 23, 25, 28, 30, 32, 35, 37, 40, \
+    42, 45, 47, 50, 52, 55, 57, 60, 62
+#define CLASS_CACHE_COUNT 11
+#define CLASS_CACHE_MAX 34
+#else
+#define CLASS_MIN_SIZE 1
+#define CLASS_COUNT 26
+#define CLASS_SIZES \
+    1, 2, 3, 4, 5, 6, 8, 11, 15, 20, 26, 34, 45, 60, 80, 106, 140, 185, \
+    245, 325, 431, 571, 756, 1001, 1326, 1757
+#define CLASS_LOG_COUNT 11
+#define CLASS_LOG_INDEX \
+    0, 1, 3, 6, 9, 11, 14, 16, 19, 21, 24
+#define CLASS_CACHE_COUNT 10
+#define CLASS_CACHE_MAX 20
+#endif
+
+#endif
@@ -0,0 +1,134 @@
+/****h* mem_alloc/gen_classes
+ *  NAME
+ *    gen_classes - write the table of the classes
+ *  SYNOPSIS
+ *    gen_classes > classes.h
+ *  DESCRIPTION
+ *    Prints classes.h, the classes of the sequence a(n) = a(n-1) + a(n-k)
+ *    for every order k of MEM_ALLOC_K and every size of pointer: the terms
+ *    from the first one of at least MIN_SIZE blocks to the last one not
+ *    bigger than MAX_BLOCKS, and for each power of 2 the first class at
+ *    least as big, and the classes cached by the threads: up to the first
+ *    one bigger than 64 blocks, 32 on 32 bits and 16 on 16 bits.  The
+ *    terms are computed on 64 bits, which is enough for all of them.
+ ******
+ */
+
+#include <stdio.h>
+
+#define K_MAX 5
+#define LINE_WIDTH 72
+
+struct target {
+    const char *test;           // condition of the preprocessor
+    unsigned long long min_size;
+    unsigned long long max_blocks;
+    unsigned long long cache_blocks;    // cached: up to the class above it
+};
+
+static const struct target targets[] = {
+    { "#if SIZE_MAX > 0xffffffff", 3, 0xffffffffffffffffull / 8 / 4, 64 },
+    { "#elif SIZE_MAX > 0xffff", 2, 0xffffffffull / 8 / 4, 32 },
+    { "#else", 1, 0xffffull / 8 / 4, 16 }
+};
+
+
+/* prints the numbers as the value of a macro, with line continuations */
+static void
+print_list(const char *name, unsigned long long *values, unsigned int count)
+{
+    unsigned int i, column;
+    char number[24];
+    printf("#define %s \\\n   ", name);
+    column = 3;
+    for (i = 0; i < count; i++)
+    {
+        column += (unsigned int)sprintf(number, " %llu%s", values[i],
+            i + 1 < count ? "," : "");
+        if (column > LINE_WIDTH)
+        {
+            printf(" \\\n   ");
+            column = 3 + (unsigned int)sprintf(number, " %llu%s", values[i],
+                i + 1 < count ? "," : "");
+        }
+        printf("%s", number);
+    }
+    printf("\n");
+}
+
+
+static void
+print_target(unsigned int k, const struct target *t)
+{
+    unsigned long long last[K_MAX], a, sizes[256], log_index[64], pow2;
+    unsigned int n, count = 0, log_count = 0, cache_count;
+
+    for (n = 0; ; n++)
+    {
+        if (n < k)
+        {
+            a = n + 1;
+        }
+        else
+        {
+            a = last[(n - 1) % k] + last[n % k];
+            if (a < last[(n - 1) % k] || a > t->max_blocks)
+            {
+                break;
+            }
+        }
+        last[n % k] = a;
+        if (a >= t->min_size)
+        {
+            sizes[count++] = a;
+        }
+    }
+    for (pow2 = 1; log_count < 64 && pow2 <= sizes[count - 1]; pow2 <<= 1)
+    {
+        for (n = 0; sizes[n] < pow2; n++)
+            ;
+        log_index[log_count] = n;
+        log_count++;
+    }
+    for (cache_count = 1; sizes[cache_count - 1] <= t->cache_blocks;
+        cache_count++)
+        ;
+    printf("%s\n", t->test);
+    printf("#define CLASS_MIN_SIZE %llu\n", t->min_size);
+    printf("#define CLASS_COUNT %u\n", count);
+    print_list("CLASS_SIZES", sizes, count);
+    printf("#define CLASS_LOG_COUNT %u\n", log_count);
+    print_list("CLASS_LOG_INDEX", log_index, log_count);
+    printf("#define CLASS_CACHE_COUNT %u\n", cache_count);
+    printf("#define CLASS_CACHE_MAX %llu\n", sizes[cache_count - 1]);
+}
+
+
+int
+main(void)
+{
+    unsigned int k, i;
+    printf("/* classes.h: written by gen_classes, do not edit\n"
+        " *\n"
+        " * For the order FIB_K and the size of a pointer, CLASS_SIZES are"
+        " the\n"
+        " * CLASS_COUNT classes in blocks, the first of at least"
+        " CLASS_MIN_SIZE,\n"
+        " * and CLASS_LOG_INDEX gives the first class of at least 2 to the"
+        " power\n"
+        " * f, for f below CLASS_LOG_COUNT.  The threads cache the"
+        " CLASS_CACHE_COUNT\n"
+        " * first classes, up to the one of CLASS_CACHE_MAX blocks.\n"
+        " */\n\n");
+    for (k = 1; k <= K_MAX; k++)
+    {
+        printf("%s FIB_K == %u\n\n", k == 1 ? "#if" : "#elif", k);
+        for (i = 0; i < sizeof(targets) / sizeof(targets[0]); i++)
+        {
+            print_target(k, &targets[i]);
+        }
+        printf("#endif\n\n");
+    }
+    printf("#endif\n");
+    return 0;
+}
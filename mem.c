@@ -4,12 +4,17 @@
  *  DESCRIPTION
  *    A simple Fibonacci memory allocator.  Uses blocks of size 8.
  *    The sequence is 1, 2, 3, 4, 5, 7, 10, 14, 19, 26..., where
- *    a(n) = a(n-1) + a(n-4).
+ *    a(n) = a(n-1) + a(n-4), or a(n) = a(n-1) + a(n-k) for another order
+ *    k chosen at compile time with MEM_ALLOC_K.
  *    Its functions are
  *    * void mem_init() to initialize the allocator
- *    * void *mem_alloc(unsigned int n) to initialize n bytes
+ *    * void *mem_alloc(size_t n) to initialize n bytes
  *    * void mem_free(void *area) to free a previously allocated area
  *    * void mem_finalize() to finalize the allocator
+ *    * int mem_check() to check the consistency of the heap
+ *    Independent heaps can be created with mem_heap_create, used with
+ *    mem_heap_alloc and mem_heap_free, and destroyed at once with
+ *    mem_heap_destroy.  mem_heap_of finds the heap of an address.
  ******
  */
 
@@ -19,43 +24,135 @@
 #include <string.h>
 #include <inttypes.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <time.h>
 
 #include "mem.h"
 
+#if MEM_ALLOC_THREADS
+#include <pthread.h>
+#endif
+
+#if MEM_ALLOC_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/* order of the sequence a(n) = a(n-1) + a(n-k), whose first terms are 1,
+ * 2... k: an item of the class i is split into a left buddy of the class
+ * i-k and a right buddy of the class i-1.  k = 1 is the binary buddy
+ * system, k = 2 the Fibonacci one
+ */
+#ifndef MEM_ALLOC_K
+#define MEM_ALLOC_K 4
+#endif
+#if MEM_ALLOC_K < 1 || MEM_ALLOC_K > 5
+#error MEM_ALLOC_K must be from 1 to 5
+#endif
+#define FIB_K MEM_ALLOC_K
+
+/* MIN_SIZE blocks hold the header and the links of a free item, and the
+ * first class is the first term of at least MIN_SIZE
+ */
+
 /* 64-bit OS */
 #if defined(__x86_64__)
 #define MIN_SIZE 3
-#define SIZE_1 4
-#define SIZE_2 5
-#define SIZE_3 7
-#define DATA_INIT_BLOCKS 69
-#define ARRAY_INIT_SIZE 11
-#define ARRAY_INIT_CAPACITY 16
+#define CHUNK_MIN_BYTES 65536
+#define DIRECT_MIN_BYTES ((size_t)16 * 1024 * 1024)
 
 /* 32-bit OS */
 #elif defined(__386__) || defined(__i386__) || defined(__DJGPP__)
 #define MIN_SIZE 2
-#define SIZE_1 3
-#define SIZE_2 4
-#define SIZE_3 5
-#define DATA_INIT_BLOCKS 36
-#define ARRAY_INIT_SIZE 10
-#define ARRAY_INIT_CAPACITY 16
+#define CHUNK_MIN_BYTES 65536
+#define DIRECT_MIN_BYTES ((size_t)16 * 1024 * 1024)
 
 /* 16-bit OS */
 #elif defined(__I86__) || defined(__86__)
 #define MIN_SIZE 1
-#define SIZE_1 2
-#define SIZE_2 3
-#define SIZE_3 4
-#define DATA_INIT_BLOCKS 19
-#define ARRAY_INIT_SIZE 9
-#define ARRAY_INIT_CAPACITY 16
+#define CHUNK_MIN_BYTES 1024
+#define DIRECT_MIN_BYTES ((size_t)16 * 1024)
 
 #else
 #error Unsupported Operating System, sorry.
 #endif
 
+#ifndef MEM_ALLOC_THREADS
+#define MEM_ALLOC_THREADS 0
+#endif
+
+/* chunk source: malloc (default) or mmap, with hugepages for big chunks */
+#ifndef MEM_ALLOC_MMAP
+#define MEM_ALLOC_MMAP 0
+#endif
+#ifndef MEM_ALLOC_HUGEPAGES
+#define MEM_ALLOC_HUGEPAGES 0
+#endif
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+/* a new chunk is at least CHUNK_MIN_BYTES and the size of the heap divided
+ * by 2 to the power CHUNK_GROWTH_SHIFT
+ */
+#define CHUNK_GROWTH_SHIFT 1
+
+/* per-thread cache: the first classes are cached, a list is refilled and
+ * flushed by batches, and is flushed when it has CACHE_MAX items
+ */
+#define CACHE_BATCH 16
+#define CACHE_MAX (2 * CACHE_BATCH)
+
+/* alloc_aligned_item searches the split tree of ALIGN_ITEMS free items of
+ * each class, looking at most at ALIGN_BUDGET items of each tree
+ */
+#ifndef ALIGN_ITEMS
+#define ALIGN_ITEMS 8
+#endif
+#ifndef ALIGN_BUDGET
+#define ALIGN_BUDGET 256
+#endif
+
+/* hardened mode: every area of an item ends with a canary and the size
+ * asked for it, is filled on alloc and on free, and is checked by free
+ */
+#ifndef MEM_ALLOC_HARDEN
+#define MEM_ALLOC_HARDEN 0
+#endif
+#define CANARY_BYTES 8
+#define CANARY_FILL 0xfd
+#define ALLOC_FILL 0xcd
+#define FREE_FILL 0xdd
+#define HARDEN_EXTRA (CANARY_BYTES + sizeof(size_t))
+#define HARDEN_FREED SIZE_MAX       /* size word of a freed area */
+
+/* slab front-end: the sizes up to SLAB_MAX_BYTES are slots of slabs, see
+ * struct slab, on the 32-bit and 64-bit systems, but not in the hardened
+ * mode, as the slots have no header to check
+ */
+#ifndef MEM_ALLOC_SLABS
+#if UINTPTR_MAX > 0xffff && !MEM_ALLOC_HARDEN
+#define MEM_ALLOC_SLABS 1
+#else
+#define MEM_ALLOC_SLABS 0
+#endif
+#endif
+#if MEM_ALLOC_SLABS && MEM_ALLOC_HARDEN
+#error MEM_ALLOC_HARDEN needs MEM_ALLOC_SLABS=0
+#endif
+#define SLAB_SIZE 4096
+#define SLAB_MAX_BYTES 64
+#define SLAB_CLASSES (SLAB_MAX_BYTES / BLOCK_SIZE)
+#define SLAB_REGION 8               /* slabs asked to the heap at once */
+#define SLAB_SET_MIN 64             /* first capacity of the set of slabs */
+
+/* mem_heap_free_batch sorts up to SORT_STACK areas without allocating,
+ * and merges runs of up to RUN_MAX adjacent items before inserting them
+ */
+#define SORT_STACK 256
+#define RUN_MAX 64
+
+/* first capacity of the chunk index, in entries */
+#define INDEX_MIN 64
+
 #define BLOCK_SIZE 8
 #define POINTER_SIZE sizeof(uintptr_t)
 #define HEADER_SIZE POINTER_SIZE
@@ -70,26 +167,134 @@
 #define RIGHT 1
 #define BLOCKS(n) ((n+BLOCK_SIZE-1)/BLOCK_SIZE)
 
+/* the biggest class: its bytes, a chunk structure and the alignment of a
+ * chunk still fit in a size_t
+ */
+#define MAX_BLOCKS ((uintptr_t)SIZE_MAX / BLOCK_SIZE / 4)
+
+/* the classes from MIN_SIZE to MAX_BLOCKS, see gen_classes.c */
+#include "classes.h"
+
+#if CLASS_MIN_SIZE != MIN_SIZE
+#error classes.h does not start at MIN_SIZE
+#endif
+
+/* the threads cache the CACHE_CLASSES first classes, up to the one of
+ * CACHE_MAX_BLOCKS blocks
+ */
+#define CACHE_CLASSES CLASS_CACHE_COUNT
+#define CACHE_MAX_BLOCKS CLASS_CACHE_MAX
+
+/* one bit per cell of the array telling whether its free list is not empty */
+#define BITMAP_BITS (sizeof(unsigned int) * CHAR_BIT)
+#define BITMAP_WORDS ((CLASS_COUNT + BITMAP_BITS - 1) / BITMAP_BITS)
+
+/* the cells of the array start on a cache line */
+#define CACHE_LINE 64
+#if defined(__GNUC__)
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE)))
+#else
+#define CACHE_ALIGNED
+#endif
+
 #define PTR_NUM(ptr) ((unsigned int)(((uintptr_t)ptr) % 0x1000))
 
 #define boolean int
 
 
-#define MEM_ALLOC_DEBUG 1
+#if CLASS_COUNT > MEM_STATS_CLASSES
+#error MEM_STATS_CLASSES is smaller than the array
+#endif
+
+/* formatted tracing on stderr, compiled only in debug builds */
+#ifndef MEM_ALLOC_DEBUG
+#define MEM_ALLOC_DEBUG 0
+#endif
+
+#if MEM_ALLOC_DEBUG
+#define debug(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define debug(...) ((void)0)
+#endif
 
+/* the bytes to allocate for x bytes, and the bytes of an item the caller
+ * can use, which are only checked and recorded in the hardened mode
+ */
+#if MEM_ALLOC_HARDEN
+#define harden_bytes(x) ((x) > SIZE_MAX / 2 ? (x) : (x) + HARDEN_EXTRA)
+#define checked_bytes(heap, item) harden_check(heap, item)
+#else
+#define harden_bytes(x) (x)
+#define checked_bytes(heap, item) item_get_bytes(item)
+#define harden_alloc(item, from, x) ((void)0)
+#define harden_free(heap, item) ((void)0)
+#endif
 
-static inline void
-debug(char *fmt, ...)
+/* binary event ring, compiled in by default and started at run time by
+ * mem_trace_enable, MEM_TRACE_SIZE must be a power of 2
+ */
+#ifndef MEM_ALLOC_TRACE
+#define MEM_ALLOC_TRACE 1
+#endif
+#ifndef MEM_TRACE_SIZE
+#define MEM_TRACE_SIZE 4096
+#endif
+
+
+#if MEM_ALLOC_TRACE
+
+/****s* mem/trace_ring
+ *  NAME
+ *    trace_ring - the last events of the allocator
+ *  DESCRIPTION
+ *    When trace_on is set, every call to the public alloc, free and
+ *    realloc functions writes one struct mem_trace_event into trace_ring,
+ *    at the position trace_pos modulo MEM_TRACE_SIZE, so that the oldest
+ *    events are overwritten.  Recording an event is only a few stores, the
+ *    formatting is left to the reader of the ring.  The class of the item
+ *    is not searched while recording: its size in blocks is kept in
+ *    blocks, and mem_trace_read computes the class.  For a slot of a slab
+ *    blocks is the size of the slot, which has no header.
+ *
+ *    In the thread-safe mode the position is taken with an atomic
+ *    increment, so each thread writes its own slot.
+ ******
+ */
+
+static struct mem_trace_event trace_ring[MEM_TRACE_SIZE];
+static unsigned long trace_pos;
+static int trace_on;
+
+#if MEM_ALLOC_THREADS
+#define TRACE_NEXT() __atomic_fetch_add(&trace_pos, 1, __ATOMIC_RELAXED)
+#else
+#define TRACE_NEXT() (trace_pos++)
+#endif
+
+#define trace(op, size, item, old_area) \
+    do { if (trace_on) trace_record(op, size, item_get_area(item), \
+            BLOCKS(item_get_bytes(item) + HEADER_SIZE), old_area); } while (0)
+#define trace_slot(op, size, area, bytes, old_area) \
+    do { if (trace_on) trace_record(op, size, area, BLOCKS(bytes), \
+            old_area); } while (0)
+
+static inline uint64_t
+trace_time(void)
 {
-    if (MEM_ALLOC_DEBUG)
-    {
-        va_list myargs;
-        va_start(myargs, fmt);
-        vfprintf(stderr, fmt, myargs);
-        va_end(myargs);
-    }
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#else
+    return (uint64_t)clock();
+#endif
 }
 
+#else
+
+#define trace(op, size, item, old_area) ((void)0)
+#define trace_slot(op, size, area, bytes, old_area) ((void)0)
+
+#endif /* MEM_ALLOC_TRACE */
+
 
 /****s*
  *  NAME mem/item
@@ -198,6 +403,25 @@ item_from_area(void *area)
 }
 
 
+#if MEM_ALLOC_TRACE
+
+static void
+trace_record(unsigned int op, uintptr_t size, void *area, uintptr_t blocks,
+    void *old_area)
+{
+    struct mem_trace_event *event;
+    event = &trace_ring[TRACE_NEXT() & (MEM_TRACE_SIZE - 1)];
+    event->time = trace_time();
+    event->area = area;
+    event->old_area = old_area;
+    event->size = size;
+    event->blocks = blocks;
+    event->op = (unsigned char)op;
+}
+
+#endif /* MEM_ALLOC_TRACE */
+
+
 // prev
 void*
 item_get_prev(void *item)
@@ -225,6 +449,8 @@ item_set_next(void *item, void *next)
     ((void**)item)[2] = next;
 }
 
+#if MEM_ALLOC_DEBUG
+
 void
 print_item(void *item, char *msg)
 {
@@ -254,23 +480,49 @@ print_item(void *item, char *msg)
     debug("\n");
 }
 
+#endif /* MEM_ALLOC_DEBUG */
+
+
+
+/****v* mem/class_sizes
+ *  NAME
+ *    class_sizes - the sizes of the classes
+ *  DESCRIPTION
+ *    The size in blocks of each class, in the order of the generalized
+ *    Fibonacci sequence, from the first term of at least MIN_SIZE to the
+ *    last one not bigger than MAX_BLOCKS.  The entry class_log_index[f] is
+ *    the index of the first class whose size is at least 2 to the power f,
+ *    for f below CLASS_LOG_COUNT.  Because the sequence grows
+ *    geometrically, there are at most a few classes between two powers of
+ *    2, so the class of any size can be found from the position of its
+ *    highest bit in a few steps.
+ *
+ *    Both tables are written by gen_classes into classes.h, and are the
+ *    same for all the heaps.
+ ******
+ */
+
+static const uintptr_t class_sizes[CLASS_COUNT] = { CLASS_SIZES };
+static const unsigned char class_log_index[CLASS_LOG_COUNT] = {
+    CLASS_LOG_INDEX
+};
 
 
 /****s* mem/cell
  *  NAME
  *    struct cell - a cell of the array
  *  DESCRIPTION
- *    The items in the array are called cells, which have two fields: the
- *    size and the pointer to the items.  Each cell represents a free list
- *    of the specified size.  The cells are arranged in the order of the
- *    generalized Fibonacci sequence.  The items in one free list are all of
- *    the same size.
+ *    The items in the array are called cells.  The cell i is the free list
+ *    of the items of class_sizes[i] blocks.  free_count is the length of
+ *    the free list and used_count the number of items of this size in use,
+ *    for mem_stats.
  ******
  */
 
 struct cell {
-    uintptr_t size;
     void *items;
+    unsigned long free_count;
+    unsigned long used_count;
 };
 
 
@@ -279,632 +531,5107 @@ struct cell {
  *    struct array - array of free lists
  *  SYNOPSIS
  *    struct array {
- *        struct cell *data;
- *        unsigned int size;
- *        unsigned int capacity;
+ *        struct cell data[CLASS_COUNT] CACHE_ALIGNED;
+ *        unsigned int bitmap_top;
+ *        unsigned int bitmap[BITMAP_WORDS];
+ *        unsigned long splits;
+ *        unsigned long merges;
  *    };
  *  DESCRIPTION
- *    The array contains free items that are available for use.  They are
- *    ordered according to the geneealized Fibonacci seqeuence in increasing
- *    order.  It's a dynamic array, meaning that when it to contain items
- *    bigger than its maximum, its capacity is increased.  The capacity
- *    field tells how many items are there before needing to create a new
- *    array and copy everything there.  The size, on the other hand, tells
- *    how many cells are used.  When a cell is in use, the cell is
- *    initialized and its size field is set.  From that point it can contain
- *    free items of a specific size.
+ *    The array contains free items that are available for use.  It has a
+ *    cell for each of the CLASS_COUNT classes, in increasing order of
+ *    size, so it never grows and is never moved.  The cells start on a
+ *    cache line, and so does the heap, whose first field is the array.
+ *
+ *    The bitmap has one bit for each cell, which is set when the free list
+ *    of the cell is not empty.  The bit w of bitmap_top is set when the
+ *    word bitmap[w] is not zero.  This way the first non-empty free list
+ *    after a given index can be found with two find-first-set operations
+ *    instead of walking the cells one by one.
+ *
+ *    splits and merges count the items split into two buddies and the
+ *    pairs of buddies merged.
  ******
  */
  
 struct array {
-    struct cell *data;
-    unsigned int size;
-    unsigned int capacity;
+    struct cell data[CLASS_COUNT] CACHE_ALIGNED;
+    unsigned int bitmap_top;
+    unsigned int bitmap[BITMAP_WORDS];
+    unsigned long splits;
+    unsigned long merges;
 };
 
 
-/****f* mem/array_inc_size
+/****s* mem/chunk
  *  NAME
- *    array_set_size - increase the size of the array by one
- *  SYNOPSIS
- *    void array_inc_size(struct array *array, unsigned int new_size)
+ *    struct chunk - memory allocated from the OS
  *  DESCRIPTION
- *    The function array_inc_size increases the size of the array by 1. 
- *    Usually it only increases the size of the array->size variable, but
- *    when the size reaches than the current capacity, a new array is
- *    allocated, data is copied into it, and the old array is freed.  Also a
- *    new capacity is assigned.  When a new size is set, it is made sure
- *    that array->size is initialized.  The array uses the functionality of
- *    the allocator in order to allocate and free for the case when it needs
- *    to copy itself into a new location.
- *  RETURN VALUE
- *    This function does not return anything.
- *******
+ *    Every chunk starts with this structure, followed by the top item and
+ *    its fake right buddy.  The next and prev fields link the chunks of a
+ *    heap into its mem_list, so that a chunk can be removed when it is
+ *    returned to the OS, and size is the number of bytes obtained from the
+ *    chunk source, which is needed to unmap the chunk.  base is the
+ *    address obtained, it is before the structure when the chunk was
+ *    moved to align its top item.
+ *
+ *    The chunk of a direct area, see direct_alloc, holds a single item
+ *    without fake right buddy, and is linked into the direct_list of the
+ *    heap instead.
+ ******
  */
 
-void*
-alloc_new_item(unsigned int n);
-void*
-take_item(struct array *array, unsigned int i);
-void*
-split_item(struct array *array, unsigned int i, void *item, uintptr_t n);
+struct chunk {
+    struct chunk *next;
+    struct chunk *prev;
+    size_t size;
+    void *base;
+};
 
-void
-array_inc_size(struct array *array)
-{
-    unsigned int i, j;
-    struct cell *new_data, *old_data;
-    array->size++;
-    i = array->size - 1;
-    array->data[i].size = array->data[i-1].size + array->data[i-4].size;
-    array->data[i].items = NULL;
-    if (array->size == array->capacity)
-    {
-        array->capacity *= 2;
 
-        old_data = array->data;
-        new_data = (struct cell*)mem_alloc(array->capacity
-                                        * (unsigned int)sizeof(struct cell));
-        for (j = 0; j < array->size; j++)
-        {
-            new_data[j] = old_data[j];
-        }
-        array->data = new_data;
-        mem_free(old_data);
-    }
-}
+#if MEM_ALLOC_MMAP
 
+static size_t page_size;
 
-void
-print_array(struct array *array)
+
+/* rounds the size up to a multiple of align, which is a power of 2 */
+static inline size_t
+round_up(size_t size, size_t align)
 {
-    unsigned int i, j;
-    void *items;
-    debug("array: ");
-    for (i = 0; i < array->size; i++)
-    {
-        if (i > 0)
-        {
-            debug(" ");
-        }
-        items = array->data[i].items;
-        if (items != NULL) {
-            debug("[%d](%d):", i, (unsigned int)array->data[i].size);
-            j = 0;
-            while (items != NULL) {
-                if (j > 0) {
-                    debug(",");
-                }
-                debug("%04x", PTR_NUM(items));
-                items = item_get_next(items);
-                j++;
-            }
-        }
-    }
-    debug("\n");
+    return (size + align - 1) & ~(align - 1);
 }
 
 
-static struct array array;
-
-/* holds the lined list of the allocated elements from the OS */
-void *mem_list;
-
-
-/****f* mem/array_init
+/****f* mem/chunk_map
  *  NAME
- *    array_init - initialize the array
+ *    chunk_map - map a region from the OS
  *  SYNOPSIS
- *    void array_init(struct array *array)
+ *    void *chunk_map(size_t *size)
  *  DESCRIPTION
- *    This function is called during the initialization of the memory. 
- *    There is a limit of the minimum size that we allocate from the OS. 
- *    The initial array has to be at least this size.  In the case of the
- *    supported architectures this size is bigger than the minimal size that
- *    can hold an array big enough so that it can be hold the array when the
- *    array is freed.  When the array needs to be resized, another space is
- *    allocated and the array is copied there.  The old area, that contained
- *    the previous version of the array, is inserted into the array and can
- *    be reused.
+ *    Maps *size bytes rounded up to whole pages.  When hugepages are
+ *    enabled and the region is at least HUGE_PAGE_SIZE, it first tries
+ *    MAP_HUGETLB, and otherwise maps a region aligned on HUGE_PAGE_SIZE,
+ *    by mapping more and unmapping the ends, and marks it with
+ *    MADV_HUGEPAGE so that transparent hugepages can back it.
  *  RETURN VALUE
- *    This function does not return any value.
+ *    The address of the region, or NULL if it could not be mapped.  The
+ *    size actually mapped is stored in *size.
  ******
  */
 
-void
-array_init(struct array *array)
+void*
+chunk_map(size_t *size)
 {
-    unsigned int i;
-    uintptr_t prev;
-
-    void *data_item = alloc_new_item(DATA_INIT_BLOCKS);
-    item_set_in_use(data_item, 1);
-    array->data = item_get_area(data_item);
-
-    array->data[0].size = MIN_SIZE;
-    array->data[0].items = NULL;
-    array->data[1].size = SIZE_1;
-    array->data[1].items = NULL;
-    array->data[2].size = SIZE_2;
-    array->data[2].items = NULL;
-    array->data[3].size = SIZE_3;
-    array->data[3].items = NULL;
-    
-    prev = array->data[3].size;
-
-    for (i = 4; i < ARRAY_INIT_SIZE; i++)
+    void *p;
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (page_size == 0)
     {
-        array->data[i].size = prev + array->data[i-4].size;
-        array->data[i].items = NULL;
-        prev = array->data[i].size;
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
     }
-
-    array->size = ARRAY_INIT_SIZE;
-    array->capacity = ARRAY_INIT_CAPACITY;
+#if MEM_ALLOC_HUGEPAGES
+    if (*size >= HUGE_PAGE_SIZE)
+    {
+        size_t len = round_up(*size, HUGE_PAGE_SIZE);
+        char *base, *aligned;
+#ifdef MAP_HUGETLB
+        p = mmap(NULL, len, prot, flags | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            *size = len;
+            return p;
+        }
+#endif
+        p = mmap(NULL, len + HUGE_PAGE_SIZE, prot, flags, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            return NULL;
+        }
+        base = p;
+        aligned = (char*)round_up((size_t)(uintptr_t)base, HUGE_PAGE_SIZE);
+        if (aligned > base)
+        {
+            munmap(base, (size_t)(aligned - base));
+        }
+        munmap(aligned + len, HUGE_PAGE_SIZE - (size_t)(aligned - base));
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+        *size = len;
+        return aligned;
+    }
+#endif
+    *size = round_up(*size, page_size);
+    p = mmap(NULL, *size, prot, flags, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
 }
 
+#endif /* MEM_ALLOC_MMAP */
 
-/****f* mem/mem_init
+
+/****f* mem/chunk_alloc
  *  NAME
- *    mem_init - initialize the memory
+ *    chunk_alloc - get a chunk from the OS
  *  SYNOPSIS
- *    void mem_init()
+ *    struct chunk *chunk_alloc(size_t size, size_t align)
  *  DESCRIPTION
- *    This function needs to be called in order to use the memory allocator. 
- *    Its main duty is to initialize mem_list and the array.  The global
- *    variable mem_list contains a linked list of all of the memory chunks
- *    that have been allocated by the Operating System, so that they can be
- *    returned, not every OS guarantees that everything will be returned if
- *    there are memory areas which are not freed.
+ *    Gets at least size bytes from the chunk source chosen at build time,
+ *    malloc or mmap, and records the size obtained in the chunk.  If align
+ *    is not 0, align more bytes are obtained and the chunk starts after
+ *    the address obtained, so that the area of its top item is aligned on
+ *    align bytes.
  *  RETURN VALUE
- *    No value is returned.
+ *    The new chunk, or NULL if the OS has no more memory.
  ******
  */
 
+struct chunk*
+chunk_alloc(size_t size, size_t align)
+{
+    struct chunk *chunk;
+    char *base;
+    uintptr_t area;
+    if (align > 0)
+    {
+        size += align;
+    }
+#if MEM_ALLOC_MMAP
+    base = chunk_map(&size);
+#else
+    base = malloc(size);
+#endif
+    if (base == NULL)
+    {
+        return NULL;
+    }
+    chunk = (struct chunk*)base;
+    if (align > 0)
+    {
+        area = (uintptr_t)base + sizeof(struct chunk) + HEADER_SIZE;
+        chunk = (struct chunk*)(base + (align - area % align) % align);
+    }
+    chunk->size = size;
+    chunk->base = base;
+    return chunk;
+}
+
+
+/* returns a chunk to the chunk source */
 void
-mem_init()
+chunk_free(struct chunk *chunk)
 {
-    debug("memory initialization\n");
-    mem_list = NULL;
-    array_init(&array);
+#if MEM_ALLOC_MMAP
+    munmap(chunk->base, chunk->size);
+#else
+    free(chunk->base);
+#endif
 }
 
 
-/****f* mem/mem_finalize
+/****s* mem/chunk_index
  *  NAME
- *    mem_finalize - return all memory used by the allocator to the OS
- *  SYNOPSIS
- *    void mem_finalize()
+ *    chunk_index - the chunks of all the heaps sorted by address
  *  DESCRIPTION
- *    The function mem_finalize is called by the user after having finished
- *    using the memory allocator.  This function goes through every item in
- *    the mem_list and returns it to the Operating System by calling the
- *    free function.
- *  RETURN VALUE
- *    Nothing is returned by this function.
+ *    Every chunk of a mem_list or of a direct_list is an entry of the
+ *    index, from the address obtained from the OS to its end, with its
+ *    heap.  The entries are kept sorted by address in one array, so that
+ *    index_find finds the chunk of any address by a binary search, in
+ *    O(log n) for n chunks.  Adding or removing a chunk moves the entries
+ *    after it, which costs little next to getting the chunk from the OS,
+ *    and the chunks grow with the heap, so there are few of them.
+ *
+ *    The array is itself a chunk, storage, obtained from chunk_alloc and
+ *    not from a heap, so that no heap is entered from another.  It is
+ *    doubled when full and returned when it becomes empty.
+ *
+ *    There is one index for all the heaps.  In the thread-safe mode it
+ *    has its own lock, which is taken after the lock of a heap, never
+ *    before.
  ******
  */
 
-void
-mem_finalize()
-{
-    array.data = NULL;
+struct chunk_entry {
+    char *start;
+    char *end;
+    struct chunk *chunk;
+    struct mem_heap *heap;
+};
 
-    // free all allocated blocks
-    while (mem_list != NULL)
+struct chunk_index {
+    struct chunk *storage;
+    struct chunk_entry *entries;
+    size_t count;
+    size_t capacity;
+#if MEM_ALLOC_THREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+#if MEM_ALLOC_THREADS
+static struct chunk_index chunk_index = { NULL, NULL, 0, 0,
+    PTHREAD_MUTEX_INITIALIZER };
+#define INDEX_LOCK() pthread_mutex_lock(&chunk_index.lock)
+#define INDEX_UNLOCK() pthread_mutex_unlock(&chunk_index.lock)
+#else
+static struct chunk_index chunk_index;
+#define INDEX_LOCK()
+#define INDEX_UNLOCK()
+#endif
+
+
+/* the number of entries starting at or before p, the lock being held */
+static size_t
+index_search(void *p)
+{
+    size_t low = 0, high = chunk_index.count, middle;
+    while (low < high)
     {
-        void *tmp = mem_list;
-        mem_list = *((void**)mem_list);
-        free(tmp);
+        middle = low + (high - low) / 2;
+        if (chunk_index.entries[middle].start <= (char*)p)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
     }
-    debug("memory finalized\n");
+    return low;
 }
 
 
-/****f* mem/take_item
- *  NAME
- *    take_item - delete the first item from a free list and return it
- *  SYNOPSIS
- *    void *take_item(struct array *array, unsigned int i)
- *  DESCRIPTION
- *    Deletes the first item from the free list at index i in the array.  It
- *    should be checked before calling this function that there is at least
- *    one item in the array cell, that is, array->data[i].items is not NULL.
- *  RETURN VALUE
- *    Returns the first item from the specified free list.
- ******
+/* the entry of the chunk holding the address p, or NULL, the lock being
+ * held
  */
-
-void*
-take_item(struct array *array, unsigned int i)
+static struct chunk_entry*
+index_find(void *p)
 {
-    void *next, *item;
-    next = item_get_next(array->data[i].items);
-    if (next != NULL)
+    size_t k = index_search(p);
+    if (k > 0 && (char*)p < chunk_index.entries[k-1].end)
     {
-        item_set_prev(next, NULL);
+        return &chunk_index.entries[k-1];
     }
-    item = array->data[i].items;
-    array->data[i].items = next;
-    return item;
+    return NULL;
 }
 
 
-/****f* mem/insert_item
+/****f* mem/index_add
  *  NAME
- *    insert_item - insert the item into the array
+ *    index_add - add a chunk of a heap to the chunk index
  *  SYNOPSIS
- *    void insert_item(struct array *array, unsigned int i, void *item)
+ *    boolean index_add(struct mem_heap *heap, struct chunk *chunk)
  *  DESCRIPTION
- *    Inserts the item into the free list at i as the first element.
+ *    Inserts the entry of the chunk at its place.  When the array is
+ *    full, a new array of twice the capacity, INDEX_MIN at first, is
+ *    obtained from chunk_alloc and the entries copied into it.
  *  RETURN VALUE
- *    This function returns nothing.
+ *    Whether the chunk was added, 0 if the OS has no more memory for the
+ *    array.
  ******
  */
 
-void
-insert_item(struct array *array, unsigned int i, void *item)
+static boolean
+index_add(struct mem_heap *heap, struct chunk *chunk)
 {
-    item_set_next(item, array->data[i].items);
-    if (array->data[i].items != NULL)
+    struct chunk *storage;
+    struct chunk_entry *entries;
+    size_t capacity, k;
+    INDEX_LOCK();
+    if (chunk_index.count == chunk_index.capacity)
     {
-        item_set_prev(array->data[i].items, item);
-    }
-    array->data[i].items = item;
-    item_set_prev(item, NULL);
-}
-
+        capacity = chunk_index.capacity > 0 ? 2 * chunk_index.capacity
+            : INDEX_MIN;
+        storage = chunk_alloc(sizeof(struct chunk)
+            + capacity * sizeof(struct chunk_entry), 0);
+        if (storage == NULL)
+        {
+            INDEX_UNLOCK();
+            return 0;
+        }
+        entries = (struct chunk_entry*)(storage + 1);
+        if (chunk_index.count > 0)
+        {
+            memcpy(entries, chunk_index.entries,
+                chunk_index.count * sizeof(struct chunk_entry));
+        }
+        if (chunk_index.storage != NULL)
+        {
+            chunk_free(chunk_index.storage);
+        }
+        chunk_index.storage = storage;
+        chunk_index.entries = entries;
+        chunk_index.capacity = capacity;
+    }
+    k = index_search(chunk->base);
+    memmove(&chunk_index.entries[k+1], &chunk_index.entries[k],
+        (chunk_index.count - k) * sizeof(struct chunk_entry));
+    chunk_index.entries[k].start = chunk->base;
+    chunk_index.entries[k].end = (char*)chunk->base + chunk->size;
+    chunk_index.entries[k].chunk = chunk;
+    chunk_index.entries[k].heap = heap;
+    chunk_index.count++;
+    INDEX_UNLOCK();
+    return 1;
+}
 
-/****f* mem/split_item
+
+/* returns the array of the index when it has no entries left, the lock
+ * being held
+ */
+static void
+index_release(void)
+{
+    if (chunk_index.count == 0 && chunk_index.storage != NULL)
+    {
+        chunk_free(chunk_index.storage);
+        chunk_index.storage = NULL;
+        chunk_index.entries = NULL;
+        chunk_index.capacity = 0;
+    }
+}
+
+
+/* removes a chunk from the index, before it is returned to the OS */
+static void
+index_remove(struct chunk *chunk)
+{
+    size_t k;
+    INDEX_LOCK();
+    k = index_search(chunk->base);
+    if (k > 0 && chunk_index.entries[k-1].chunk == chunk)
+    {
+        memmove(&chunk_index.entries[k-1], &chunk_index.entries[k],
+            (chunk_index.count - k) * sizeof(struct chunk_entry));
+        chunk_index.count--;
+        index_release();
+    }
+    INDEX_UNLOCK();
+}
+
+
+/* removes all the chunks of a heap from the index in one pass, when the
+ * heap is destroyed, or moves them to the heap to if it is not NULL, when
+ * the structure of the heap is moved
+ */
+static void
+index_move_heap(struct mem_heap *heap, struct mem_heap *to)
+{
+    size_t k, m = 0;
+    INDEX_LOCK();
+    for (k = 0; k < chunk_index.count; k++)
+    {
+        if (chunk_index.entries[k].heap == heap)
+        {
+            if (to == NULL)
+            {
+                continue;
+            }
+            chunk_index.entries[k].heap = to;
+        }
+        chunk_index.entries[m++] = chunk_index.entries[k];
+    }
+    chunk_index.count = m;
+    index_release();
+    INDEX_UNLOCK();
+}
+
+
+/* the item of a direct area has a size of 0, like a fake right buddy,
+ * which is never the item of an area
+ */
+static inline boolean
+item_is_direct(void *item)
+{
+    return item_get_size(item) == 0;
+}
+
+static inline struct chunk*
+direct_get_chunk(void *item)
+{
+    return (struct chunk*)((char*)item - sizeof(struct chunk));
+}
+
+/* the bytes usable in the area of an item, or of a direct area */
+static inline size_t
+item_get_bytes(void *item)
+{
+    struct chunk *chunk;
+    if (item_is_direct(item))
+    {
+        chunk = direct_get_chunk(item);
+        return (size_t)((char*)chunk->base + chunk->size
+            - (char*)item_get_area(item));
+    }
+    return item_get_size(item) * BLOCK_SIZE - HEADER_SIZE;
+}
+
+
+/* cumulative counters of the allocations, for mem_stats: the bytes asked
+ * and the usable bytes of the areas given for them
+ */
+struct alloc_counters {
+    uint64_t requested;
+    uint64_t handed_out;
+    unsigned long allocations;
+};
+
+static inline void
+count_bytes(struct alloc_counters *counters, size_t x, uintptr_t bytes)
+{
+    counters->requested += x;
+    counters->handed_out += bytes;
+    counters->allocations++;
+}
+
+static inline void
+count_alloc(struct alloc_counters *counters, size_t x, void *item)
+{
+    count_bytes(counters, x, item_get_bytes(item));
+}
+
+
+#if MEM_ALLOC_SLABS
+
+/****s* mem/slab
  *  NAME
- *    split_item - split an item until of the requested size is created
+ *    struct slab - a page of small slots of the same size
+ *  DESCRIPTION
+ *    The sizes up to SLAB_MAX_BYTES would cost an item of MIN_SIZE blocks
+ *    or more each, header included, and a split.  They are rounded up to
+ *    a multiple of BLOCK_SIZE instead, and served from slabs: pages of
+ *    SLAB_SIZE bytes, aligned on SLAB_SIZE, starting with this structure
+ *    and followed by slots of size bytes without header.  The free slots
+ *    of a slab are linked through their first word from free, and the
+ *    slots after top have never been used, so a new slab is not walked.
+ *
+ *    A slab with free slots is in the list of its class in the heap, and
+ *    a full slab is in no list.  A slab whose slots are all free is empty:
+ *    its size is 0 and it is in the list of the empty slabs of the heap,
+ *    ready for any class.
+ *
+ *    The slabs are carved from an item of the heap of SLAB_REGION slabs,
+ *    the region, at the addresses of its area aligned on SLAB_SIZE, so it
+ *    holds count slabs, SLAB_REGION or one less.  Its first slab is
+ *    region, and keeps the item, count, and empty, the number of its
+ *    empty slabs.  An area is in a slab when its address rounded down to
+ *    SLAB_SIZE is in the set of the slabs of the heap, see struct
+ *    slab_set.
+ ******
+ */
+
+struct slab {
+    struct slab *next;
+    struct slab *prev;
+    struct slab *region;
+    void *free;
+    char *top;
+    unsigned int size;          /* bytes of a slot, 0 for an empty slab */
+    unsigned int used;          /* slots in use */
+    void *item;                 /* in the first slab of a region */
+    unsigned int count;         /* in the first slab of a region */
+    unsigned int empty;         /* in the first slab of a region */
+};
+
+/* the slots start after the structure, aligned on 16 bytes */
+#define SLAB_HEADER ((sizeof(struct slab) + 15) & ~(size_t)15)
+#define SLAB_CLASS(x) ((x) == 0 ? 0 : ((x) - 1) / BLOCK_SIZE)
+#define SLAB_SLOT_BYTES(x) ((SLAB_CLASS(x) + 1) * BLOCK_SIZE)
+
+/* open addressing set of the addresses of the slabs of a heap, keys has
+ * mask + 1 entries, a power of 2, and is an item of the heap
+ */
+struct slab_set {
+    struct slab **keys;
+    uintptr_t mask;
+    unsigned long count;
+};
+
+#endif /* MEM_ALLOC_SLABS */
+
+
+/****s* mem/mem_heap
+ *  NAME
+ *    struct mem_heap - an independent heap
+ *  DESCRIPTION
+ *    A heap owns an array of free lists and mem_list, the linked list of
+ *    the chunks it has allocated from the OS.  The items of a heap are
+ *    never merged with the items of another heap, and destroying a heap
+ *    returns all its chunks at once, without freeing the items one by one.
+ *
+ *    When a free item is merged up to a whole chunk, the chunk is free and
+ *    its size is added to free_chunk_bytes.  When free_chunk_bytes becomes
+ *    bigger than release_threshold, free chunks are returned to the OS
+ *    until at most retain_bytes are kept.
+ *
+ *    chunk_bytes is the total size of the chunks of the heap.  When no
+ *    free item fits, the new chunk is big enough for the request, at least
+ *    min_chunk_bytes and at least chunk_bytes >> growth_shift, so that the
+ *    number of chunks grows logarithmically with the size of the heap.
+ *
+ *    The realloc_ fields count the calls to mem_heap_realloc and how many
+ *    of them could keep the area where it was.  chunk_count and counters
+ *    are reported by mem_stats with the counts of the cells.
+ *
+ *    The small sizes are served by the slabs of the heap, see struct
+ *    slab: slabs holds the slabs with free slots of each class, and
+ *    slab_empty the empty ones.  slab_count slabs are carved, and
+ *    slot_count slots are in use.
+ *
+ *    The chunks of the direct areas are linked into direct_list, and
+ *    counted by direct_count and direct_bytes, apart from chunk_bytes,
+ *    which sets the size of the next chunks.
+ *
+ *    In the lazy mode, set by mem_heap_set_lazy, the items freed are not
+ *    merged: they stay marked in use, which keeps their buddies from
+ *    merging with them, and are pushed on unmerged, a list per class
+ *    linked through the next field of the area.  unmerged_count counts
+ *    the items of each list, and unmerged_items all of them.  A list is
+ *    merged down to half of lazy_max when it has more than lazy_max items,
+ *    and all of them when no free item is big enough for an allocation.
+ *
+ *    The global functions mem_alloc and mem_free use default_heap.  The
+ *    structure of the other heaps is allocated inside the heap itself, so
+ *    it disappears with its chunks.
+ *
+ *    In the thread-safe mode each heap has its own lock, and the heaps
+ *    made by mem_heap_create are linked by next_heap into heap_list, so
+ *    that the fork handlers can take all their locks.
+ ******
+ */
+
+struct mem_heap {
+    struct array array;
+    struct chunk *mem_list;
+    size_t free_chunk_bytes;
+    size_t retain_bytes;
+    size_t release_threshold;
+    size_t chunk_bytes;
+    size_t min_chunk_bytes;
+    unsigned int growth_shift;
+    unsigned long realloc_calls;
+    unsigned long realloc_grown;
+    unsigned long realloc_shrunk;
+    unsigned long realloc_moved;
+    unsigned long chunk_count;
+    struct alloc_counters counters;
+    struct chunk *direct_list;
+    unsigned long direct_count;
+    size_t direct_bytes;
+    void *unmerged[CLASS_COUNT];
+    unsigned int unmerged_count[CLASS_COUNT];
+    unsigned long unmerged_items;
+    unsigned int lazy_max;
+#if MEM_ALLOC_SLABS
+    struct slab *slabs[SLAB_CLASSES];
+    struct slab *slab_empty;
+    unsigned long slab_empty_count;
+    unsigned long slab_count;
+    unsigned long slot_count;
+    struct slab_set slab_set;
+#endif
+#if MEM_ALLOC_THREADS
+    pthread_mutex_t lock;
+    struct mem_heap *next_heap;
+#endif
+};
+
+#if MEM_ALLOC_THREADS
+#define HEAP_LOCK_INIT(heap) pthread_mutex_init(&(heap)->lock, NULL)
+#define HEAP_LOCK_DESTROY(heap) pthread_mutex_destroy(&(heap)->lock)
+#define HEAP_LOCK(heap) pthread_mutex_lock(&(heap)->lock)
+#define HEAP_UNLOCK(heap) pthread_mutex_unlock(&(heap)->lock)
+#else
+#define HEAP_LOCK_INIT(heap)
+#define HEAP_LOCK_DESTROY(heap)
+#define HEAP_LOCK(heap)
+#define HEAP_UNLOCK(heap)
+#endif
+
+
+/* index of the lowest bit set in w, w must not be 0 */
+static inline unsigned int
+bit_first(unsigned int w)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctz(w);
+#else
+    unsigned int b = 0;
+    while ((w & 1) == 0)
+    {
+        w >>= 1;
+        b++;
+    }
+    return b;
+#endif
+}
+
+
+/* index of the highest bit set in n, n must not be 0 */
+static inline unsigned int
+bit_last(uintptr_t n)
+{
+#if defined(__GNUC__)
+    return (unsigned int)(sizeof(unsigned long long) * CHAR_BIT - 1)
+        - (unsigned int)__builtin_clzll((unsigned long long)n);
+#else
+    unsigned int b = 0;
+    while (n > 1)
+    {
+        n >>= 1;
+        b++;
+    }
+    return b;
+#endif
+}
+
+
+/* mask of the bits from b to the highest one */
+static inline unsigned int
+bits_from(unsigned int b)
+{
+    return b < BITMAP_BITS ? ~0u << b : 0;
+}
+
+
+/****f* mem/array_set_nonempty
+ *  NAME
+ *    array_set_nonempty - mark the free list of a cell as (non) empty
  *  SYNOPSIS
- *      void* split_item(struct array *array, unsigned int i, void *item,
- *          uintptr_t n)
+ *    void array_set_nonempty(struct array *array, unsigned int i,
+ *        boolean nonempty)
  *  DESCRIPTION
- *      This function is given the number of blocks requested, an item, and
- *      the index of the free list corresponding to its size in the array. 
- *      The purpose is to reduce the size of the item by splitting it into
- *      two buddies and inserting one of them into the free list, until we
- *      get an item as small as possible that can hold n blocks.
+ *    Sets or clears the bit of the cell i in the bitmap and updates the bit
+ *    of its word in bitmap_top.  Must be called every time the free list of
+ *    the cell i becomes empty or stops being empty.
+ *  RETURN VALUE
+ *    This function returns nothing.
+ ******
+ */
+
+void
+array_set_nonempty(struct array *array, unsigned int i, boolean nonempty)
+{
+    unsigned int w = (unsigned int)(i / BITMAP_BITS);
+    unsigned int b = (unsigned int)(i % BITMAP_BITS);
+    if (nonempty)
+    {
+        array->bitmap[w] |= 1u << b;
+        array->bitmap_top |= 1u << w;
+    }
+    else
+    {
+        array->bitmap[w] &= ~(1u << b);
+        if (array->bitmap[w] == 0)
+        {
+            array->bitmap_top &= ~(1u << w);
+        }
+    }
+}
+
+
+/****f* mem/array_find_nonempty
+ *  NAME
+ *    array_find_nonempty - find the first non-empty free list from an index
+ *  SYNOPSIS
+ *    unsigned int array_find_nonempty(struct array *array, unsigned int i)
+ *  DESCRIPTION
+ *    Looks in the bitmap for the first cell at the index i or after it
+ *    whose free list contains at least one item.  First the word containing
+ *    the bit i is checked, then bitmap_top gives the next non-zero word.
+ *  RETURN VALUE
+ *    The index of the cell found, or CLASS_COUNT if all the free lists
+ *    starting from i are empty.
+ ******
+ */
+
+unsigned int
+array_find_nonempty(struct array *array, unsigned int i)
+{
+    unsigned int w, m;
+    if (i >= CLASS_COUNT)
+    {
+        return CLASS_COUNT;
+    }
+    w = (unsigned int)(i / BITMAP_BITS);
+    m = array->bitmap[w] & bits_from((unsigned int)(i % BITMAP_BITS));
+    if (m == 0)
+    {
+        m = array->bitmap_top & bits_from(w + 1);
+        if (m == 0)
+        {
+            return CLASS_COUNT;
+        }
+        w = bit_first(m);
+        m = array->bitmap[w];
+    }
+    return w * (unsigned int)BITMAP_BITS + bit_first(m);
+}
+
+
+/****f* mem/class_index
+ *  NAME
+ *    class_index - find the smallest class that can hold n blocks
+ *  SYNOPSIS
+ *    unsigned int class_index(uintptr_t n)
+ *  DESCRIPTION
+ *    The highest bit of n gives the power of 2 just below n, and
+ *    class_log_index gives the first class at least as big as this power.
+ *    From there at most a few classes have to be skipped until the size
+ *    reaches n.  When n is the size of an item, the class returned is the
+ *    one of this item, and the cell of the array its free list.
+ *  RETURN VALUE
+ *    The index of the class, or CLASS_COUNT if all classes are too small.
+ ******
+ */
+
+unsigned int
+class_index(uintptr_t n)
+{
+    unsigned int i, f;
+    f = bit_last(n > 0 ? n : 1);
+    if (f >= CLASS_LOG_COUNT)
+    {
+        return CLASS_COUNT;
+    }
+    i = class_log_index[f];
+    while (i < CLASS_COUNT && class_sizes[i] < n)
+    {
+        i++;
+    }
+    return i;
+}
+
+
+void*
+alloc_new_item(struct mem_heap *heap, uintptr_t n, size_t align);
+void*
+take_item(struct array *array, unsigned int i);
+void
+delete_item(struct array *array, unsigned int i, void *item);
+struct chunk*
+item_get_chunk(void *item);
+void
+heap_trim(struct mem_heap *heap, size_t keep);
+void
+heap_release_chunk(struct mem_heap *heap, struct chunk *chunk);
+unsigned int
+heap_chunk_class(struct mem_heap *heap, uintptr_t n);
+void*
+split_item(struct array *array, unsigned int *pi, void *item, uintptr_t n);
+void*
+alloc_item(struct mem_heap *heap, uintptr_t n);
+void
+free_item(struct mem_heap *heap, void *item);
+unsigned int
+coalesce(struct array *array, unsigned int i);
+void
+merge_item(struct mem_heap *heap, void *item, unsigned int i);
+unsigned int
+heap_find_free(struct mem_heap *heap, unsigned int c);
+boolean
+merge_all(struct mem_heap *heap);
+
+
+#if MEM_ALLOC_DEBUG
+
+void
+print_array(struct array *array)
+{
+    unsigned int i, j;
+    void *items;
+    debug("array: ");
+    for (i = 0; i < CLASS_COUNT; i++)
+    {
+        if (i > 0)
+        {
+            debug(" ");
+        }
+        items = array->data[i].items;
+        if (items != NULL) {
+            debug("[%d](%d):", i, (unsigned int)class_sizes[i]);
+            j = 0;
+            while (items != NULL) {
+                if (j > 0) {
+                    debug(",");
+                }
+                debug("%04x", PTR_NUM(items));
+                items = item_get_next(items);
+                j++;
+            }
+        }
+    }
+    debug("\n");
+}
+
+#endif /* MEM_ALLOC_DEBUG */
+
+
+static struct mem_heap default_heap;
+
+#if MEM_ALLOC_THREADS
+/* the heaps made by mem_heap_create, its lock is taken before the lock of
+ * any heap
+ */
+static struct mem_heap *heap_list;
+static pthread_mutex_t heap_list_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* in the thread-safe mode the default heap has no slabs: its small sizes
+ * are in the caches of the threads
+ */
+#if MEM_ALLOC_THREADS
+#define heap_has_slabs(heap) ((heap) != &default_heap)
+#else
+#define heap_has_slabs(heap) 1
+#endif
+
+
+#if MEM_ALLOC_THREADS
+
+/****s* mem/cache
+ *  NAME
+ *    struct cache - per-thread cache of small free items
+ *  DESCRIPTION
+ *    In the thread-safe mode every thread keeps a small free list for each
+ *    of the CACHE_CLASSES smallest classes.  The items in the cache are
+ *    still marked in use, so that the shared heap never merges them with
+ *    their buddies, and they are linked through the next field of the
+ *    area.  mem_alloc and mem_free use the cache without taking any lock. 
+ *    Only when a list of the cache is empty (refill) or too long (flush),
+ *    CACHE_BATCH items are moved from or to the default heap while holding
+ *    its lock.
  *
- *      So, at each step we check if the item needs to be split.  Then we
- *      split it and determine if we want to use the left buddy or the right
- *      buddy, and we continue the loop, which this time checks the buddy we
- *      have chosen and so on.  The buddy that is not used is inserted back
- *      into the free list.
+ *    The allocations served by the cache are counted in its counters,
+ *    which are added to the counters of the default heap at the next
+ *    refill or flush, while the lock is held anyway.
+ ******
+ */
+
+struct cache {
+    void *items[CACHE_CLASSES];
+    unsigned int count[CACHE_CLASSES];
+    boolean registered;
+    struct alloc_counters counters;
+};
+
+static pthread_key_t cache_key;
+static __thread struct cache cache;
+
+/* the class of each small size, filled by mem_init */
+static unsigned char cache_index[CACHE_MAX_BLOCKS + 1];
+
+
+void
+cache_init()
+{
+    unsigned int i = 0;
+    uintptr_t n;
+    for (n = 0; n <= CACHE_MAX_BLOCKS; n++)
+    {
+        while (class_sizes[i] < n)
+        {
+            i++;
+        }
+        cache_index[n] = (unsigned char)i;
+    }
+}
+
+
+/* moves the counters of the cache to the default heap, with its lock */
+static inline void
+cache_count(struct cache *c)
+{
+    default_heap.counters.requested += c->counters.requested;
+    default_heap.counters.handed_out += c->counters.handed_out;
+    default_heap.counters.allocations += c->counters.allocations;
+    c->counters.requested = 0;
+    c->counters.handed_out = 0;
+    c->counters.allocations = 0;
+}
+
+
+/****f* mem/cache_flush
+ *  NAME
+ *    cache_flush - return cached items of one class to the shared heap
+ *  SYNOPSIS
+ *    void cache_flush(struct cache *c, unsigned int i, unsigned int count)
+ *  DESCRIPTION
+ *    Takes count items from the cache list i and frees them into the
+ *    shared heap under the lock, so that they can be merged again.
+ *  RETURN VALUE
+ *    This function returns nothing.
+ ******
+ */
+
+void
+cache_flush(struct cache *c, unsigned int i, unsigned int count)
+{
+    void *item;
+    HEAP_LOCK(&default_heap);
+    cache_count(c);
+    while (count > 0 && c->items[i] != NULL)
+    {
+        item = c->items[i];
+        c->items[i] = item_get_next(item);
+        c->count[i]--;
+        free_item(&default_heap, item);
+        count--;
+    }
+    HEAP_UNLOCK(&default_heap);
+}
+
+
+/* makes sure that the cache is flushed when the thread exits, the flag
+ * is set first because pthread_setspecific can call malloc, which can be
+ * mem_alloc
+ */
+static inline void
+cache_register(struct cache *c)
+{
+    if (!c->registered)
+    {
+        c->registered = 1;
+        pthread_setspecific(cache_key, c);
+    }
+}
+
+
+/* called when a thread exits with its cache as value */
+void
+cache_destroy(void *value)
+{
+    struct cache *c = value;
+    unsigned int i;
+    for (i = 0; i < CACHE_CLASSES; i++)
+    {
+        cache_flush(c, i, c->count[i]);
+    }
+    c->registered = 0;      // registered again if another destructor allocates
+}
+
+
+/* fork: the thread calling fork takes the locks of the heap list, of all
+ * the heaps and of the index, in this order, waiting for the other
+ * threads to leave them, so that the child gets every heap in a
+ * consistent state, and initializes them again in the child, where it is
+ * the only thread
+ */
+static boolean fork_ready;
+static boolean atfork_done;
+
+static void
+fork_prepare(void)
+{
+    struct mem_heap *heap;
+    if (fork_ready)
+    {
+        pthread_mutex_lock(&heap_list_lock);
+        HEAP_LOCK(&default_heap);
+        for (heap = heap_list; heap != NULL; heap = heap->next_heap)
+        {
+            HEAP_LOCK(heap);
+        }
+        INDEX_LOCK();
+    }
+}
+
+static void
+fork_parent(void)
+{
+    struct mem_heap *heap;
+    if (fork_ready)
+    {
+        INDEX_UNLOCK();
+        for (heap = heap_list; heap != NULL; heap = heap->next_heap)
+        {
+            HEAP_UNLOCK(heap);
+        }
+        HEAP_UNLOCK(&default_heap);
+        pthread_mutex_unlock(&heap_list_lock);
+    }
+}
+
+static void
+fork_child(void)
+{
+    struct mem_heap *heap;
+    if (fork_ready)
+    {
+        pthread_mutex_init(&chunk_index.lock, NULL);
+        for (heap = heap_list; heap != NULL; heap = heap->next_heap)
+        {
+            HEAP_LOCK_INIT(heap);
+        }
+        HEAP_LOCK_INIT(&default_heap);
+        pthread_mutex_init(&heap_list_lock, NULL);
+    }
+}
+
+
+/****f* mem/cache_refill
+ *  NAME
+ *    cache_refill - allocate a batch of items of a cached class
+ *  SYNOPSIS
+ *    void *cache_refill(struct cache *c, unsigned int i, uintptr_t n)
+ *  DESCRIPTION
+ *    Called when the cache list i is empty.  Under the lock it allocates
+ *    the item for the caller and up to CACHE_BATCH - 1 more items of the
+ *    size of the class i, which are put in the cache.  The small classes
+ *    cannot always be split down to their size, when an item of another
+ *    size is returned, it is freed back and the refill stops.
+ *  RETURN VALUE
+ *    An item of minimum n blocks, or NULL if the heap cannot grow.
+ ******
+ */
+
+void*
+cache_refill(struct cache *c, unsigned int i, uintptr_t n)
+{
+    unsigned int j;
+    void *item, *extra;
+    cache_register(c);
+    HEAP_LOCK(&default_heap);
+    cache_count(c);
+    item = alloc_item(&default_heap, n);
+    for (j = 1; j < CACHE_BATCH && item != NULL; j++)
+    {
+        extra = alloc_item(&default_heap, class_sizes[i]);
+        if (extra == NULL)
+        {
+            break;
+        }
+        if (item_get_size(extra) != class_sizes[i])
+        {
+            free_item(&default_heap, extra);
+            break;
+        }
+        item_set_next(extra, c->items[i]);
+        c->items[i] = extra;
+        c->count[i]++;
+    }
+    HEAP_UNLOCK(&default_heap);
+    return item;
+}
+
+
+/* takes an item of minimum n blocks from the cache of the thread */
+static inline void*
+cache_alloc(struct cache *c, uintptr_t n)
+{
+    unsigned int i = cache_index[n];
+    void *item = c->items[i];
+    if (item == NULL)
+    {
+        return cache_refill(c, i, n);
+    }
+    c->items[i] = item_get_next(item);
+    c->count[i]--;
+    return item;
+}
+
+
+/* puts a small item into the cache of the thread */
+static inline void
+cache_free(struct cache *c, void *item)
+{
+    unsigned int i = cache_index[item_get_size(item)];
+    cache_register(c);
+    item_set_next(item, c->items[i]);
+    c->items[i] = item;
+    c->count[i]++;
+    if (c->count[i] >= CACHE_MAX)
+    {
+        cache_flush(c, i, CACHE_BATCH);
+    }
+}
+
+#endif /* MEM_ALLOC_THREADS */
+
+
+/****f* mem/array_init
+ *  NAME
+ *    array_init - initialize the array
+ *  SYNOPSIS
+ *    void array_init(struct array *array)
+ *  DESCRIPTION
+ *    Empties the free lists of all the classes and clears the counters.
+ *    The sizes of the classes are constant, and no memory is taken from
+ *    the OS until the first allocation.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+array_init(struct array *array)
+{
+    memset(array, 0, sizeof(*array));
+}
+
+
+/****f* mem/heap_init
+ *  NAME
+ *    heap_init - initialize a heap
+ *  SYNOPSIS
+ *    void heap_init(struct mem_heap *heap)
+ *  DESCRIPTION
+ *    Initializes the mem_list and the array of the heap, and keeps all the
+ *    free chunks until a retention policy is set.  The mem_list
+ *    contains a linked list of all of the memory chunks that have been
+ *    allocated by the Operating System for this heap, so that they can be
+ *    returned, not every OS guarantees that everything will be returned if
+ *    there are memory areas which are not freed.  The heap starts empty,
+ *    its first chunk is taken by its first allocation.  The lock of the
+ *    heap is initialized separately, because the structure can be copied.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+heap_init(struct mem_heap *heap)
+{
+    heap->mem_list = NULL;
+    heap->free_chunk_bytes = 0;
+    heap->retain_bytes = (size_t)-1;
+    heap->release_threshold = (size_t)-1;
+    heap->chunk_bytes = 0;
+    heap->min_chunk_bytes = CHUNK_MIN_BYTES;
+    heap->growth_shift = CHUNK_GROWTH_SHIFT;
+    heap->realloc_calls = 0;
+    heap->realloc_grown = 0;
+    heap->realloc_shrunk = 0;
+    heap->realloc_moved = 0;
+    heap->chunk_count = 0;
+    heap->counters.requested = 0;
+    heap->counters.handed_out = 0;
+    heap->counters.allocations = 0;
+    heap->direct_list = NULL;
+    heap->direct_count = 0;
+    heap->direct_bytes = 0;
+    memset(heap->unmerged, 0, sizeof(heap->unmerged));
+    memset(heap->unmerged_count, 0, sizeof(heap->unmerged_count));
+    heap->unmerged_items = 0;
+    heap->lazy_max = 0;
+#if MEM_ALLOC_SLABS
+    memset(heap->slabs, 0, sizeof(heap->slabs));
+    heap->slab_empty = NULL;
+    heap->slab_empty_count = 0;
+    heap->slab_count = 0;
+    heap->slot_count = 0;
+    heap->slab_set.keys = NULL;
+    heap->slab_set.mask = 0;
+    heap->slab_set.count = 0;
+#endif
+    array_init(&heap->array);
+}
+
+
+/****f* mem/chunks_free
+ *  NAME
+ *    chunks_free - return a list of chunks to the OS
+ *  SYNOPSIS
+ *    void chunks_free(struct chunk *mem_list)
+ *  DESCRIPTION
+ *    Goes through every chunk of the mem_list of a heap and returns it to
+ *    the Operating System with chunk_free.  The list is passed by value
+ *    because the heap itself can be inside one of the chunks.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+chunks_free(struct chunk *mem_list)
+{
+    while (mem_list != NULL)
+    {
+        struct chunk *tmp = mem_list;
+        mem_list = mem_list->next;
+        chunk_free(tmp);
+    }
+}
+
+
+/****f* mem/mem_init
+ *  NAME
+ *    mem_init - initialize the memory
+ *  SYNOPSIS
+ *    void mem_init()
+ *  DESCRIPTION
+ *    This function needs to be called in order to use the global functions
+ *    of the memory allocator.  It initializes the default heap.
+ *
+ *    In the thread-safe mode it also prepares the per-thread caches and
+ *    installs fork handlers, which hold the locks of all the heaps during
+ *    fork, so that the child can go on allocating.  It must be
+ *    called before any other thread uses the allocator.
+ *  RETURN VALUE
+ *    No value is returned.
+ ******
+ */
+
+void
+mem_init()
+{
+    debug("memory initialization\n");
+    heap_init(&default_heap);
+    HEAP_LOCK_INIT(&default_heap);
+#if MEM_ALLOC_THREADS
+    cache_init();
+    pthread_key_create(&cache_key, cache_destroy);
+    if (!atfork_done)
+    {
+        pthread_atfork(fork_prepare, fork_parent, fork_child);
+        atfork_done = 1;
+    }
+    fork_ready = 1;
+#endif
+}
+
+
+/****f* mem/mem_finalize
+ *  NAME
+ *    mem_finalize - return all memory used by the allocator to the OS
+ *  SYNOPSIS
+ *    void mem_finalize()
+ *  DESCRIPTION
+ *    The function mem_finalize is called by the user after having finished
+ *    using the memory allocator.  This function returns every chunk of the
+ *    default heap to the Operating System.  The heaps created by
+ *    mem_heap_create are not affected.
+ *
+ *    In the thread-safe mode the other threads must have exited, and the
+ *    cache of the calling thread is dropped with the rest of the memory.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+mem_finalize()
+{
+#if MEM_ALLOC_THREADS
+    fork_ready = 0;
+    pthread_key_delete(cache_key);
+    memset(&cache, 0, sizeof(cache));
+#endif
+    HEAP_LOCK_DESTROY(&default_heap);
+
+    // free all allocated blocks
+    index_move_heap(&default_heap, NULL);
+    chunks_free(default_heap.direct_list);
+    default_heap.direct_list = NULL;
+    chunks_free(default_heap.mem_list);
+    default_heap.mem_list = NULL;
+    debug("memory finalized\n");
+}
+
+
+/****f* mem/take_item
+ *  NAME
+ *    take_item - delete the first item from a free list and return it
+ *  SYNOPSIS
+ *    void *take_item(struct array *array, unsigned int i)
+ *  DESCRIPTION
+ *    Deletes the first item from the free list at index i in the array.  It
+ *    should be checked before calling this function that there is at least
+ *    one item in the array cell, that is, array->data[i].items is not NULL.
+ *  RETURN VALUE
+ *    Returns the first item from the specified free list.
+ ******
+ */
+
+void*
+take_item(struct array *array, unsigned int i)
+{
+    void *next, *item;
+    next = item_get_next(array->data[i].items);
+    if (next != NULL)
+    {
+        item_set_prev(next, NULL);
+    }
+    item = array->data[i].items;
+    array->data[i].items = next;
+    array->data[i].free_count--;
+    if (next == NULL)
+    {
+        array_set_nonempty(array, i, 0);
+    }
+    return item;
+}
+
+
+/****f* mem/insert_item
+ *  NAME
+ *    insert_item - insert the item into the array
+ *  SYNOPSIS
+ *    void insert_item(struct array *array, unsigned int i, void *item)
+ *  DESCRIPTION
+ *    Inserts the item into the free list at i as the first element.
+ *  RETURN VALUE
+ *    This function returns nothing.
+ ******
+ */
+
+void
+insert_item(struct array *array, unsigned int i, void *item)
+{
+    item_set_next(item, array->data[i].items);
+    if (array->data[i].items != NULL)
+    {
+        item_set_prev(array->data[i].items, item);
+    }
+    else
+    {
+        array_set_nonempty(array, i, 1);
+    }
+    array->data[i].items = item;
+    array->data[i].free_count++;
+    item_set_prev(item, NULL);
+}
+
+
+/****f* mem/split_buddies
+ *  NAME
+ *    split_buddies - split an item into its two buddies
+ *  SYNOPSIS
+ *      void *split_buddies(struct array *array, void *item, unsigned int i)
+ *  DESCRIPTION
+ *      The item of the class i becomes the left buddy, of the class i - k,
+ *      followed by the right buddy, of the class i - 1.  Both are free and
+ *      are not inserted in any free list.  The left buddy inherits the
+ *      lr_bit of the item and the right buddy its inh_bit.
+ *  RETURN VALUE
+ *      The right buddy.
+ ******
+ */
+
+void*
+split_buddies(struct array *array, void *item, unsigned int i)
+{
+    void *left, *right;
+    uintptr_t szl, szr;
+    boolean inh_l, inh_r;
+    array->splits++;
+    szl = class_sizes[i-FIB_K];
+    szr = class_sizes[i-1];
+    inh_l = item_get_lr_bit(item);
+    inh_r = item_get_inh_bit(item);
+    left = item;
+    right = ((char*)item) + szl * BLOCK_SIZE;
+    item_set_size(left, szl);
+    item_set_size(right, szr);
+    item_set_lr_bit(left, LEFT);
+    item_set_lr_bit(right, RIGHT);
+    item_set_in_use(left, 0);
+    item_set_in_use(right, 0);
+    item_set_inh_bit(left, inh_l);
+    item_set_inh_bit(right, inh_r);
+    return right;
+}
+
+
+/****f* mem/split_item
+ *  NAME
+ *    split_item - split an item until of the requested size is created
+ *  SYNOPSIS
+ *      void* split_item(struct array *array, unsigned int *pi, void *item,
+ *          uintptr_t n)
+ *  DESCRIPTION
+ *      This function is given the number of blocks requested, an item, and
+ *      in *pi the index of the free list corresponding to its size in the
+ *      array, which is set to the index of the size of the item returned.
+ *      The purpose is to reduce the size of the item by splitting it into
+ *      two buddies and inserting one of them into the free list, until we
+ *      get an item as small as possible that can hold n blocks.
+ *
+ *      So, at each step we check if the item needs to be split.  Then we
+ *      split it and determine if we want to use the left buddy or the right
+ *      buddy, and we continue the loop, which this time checks the buddy we
+ *      have chosen and so on.  The buddy that is not used is inserted back
+ *      into the free list.
+ ******
+ */
+
+void*
+split_item(struct array *array, unsigned int *pi, void *item, uintptr_t n)
+{
+    void *curr, *right;
+    unsigned int i = *pi;
+    curr = item;
+    while (i > FIB_K && class_sizes[i-1] >= n)
+    {
+        right = split_buddies(array, curr, i);
+        if (class_sizes[i-FIB_K] >= n)
+        {
+            insert_item(array, i - 1, right);
+            i = i - FIB_K;
+        }
+        else
+        {
+            insert_item(array, i - FIB_K, curr);
+            i = i - 1;
+            curr = right;
+        }
+    }
+    *pi = i;
+    return curr;
+}
+
+
+/****f* mem/item_get_chunk
+ *  NAME
+ *    item_get_chunk - the chunk of an item which fills a whole chunk
+ *  SYNOPSIS
+ *    struct chunk *item_get_chunk(void *item)
+ *  DESCRIPTION
+ *    Only the top item of a chunk is followed by the fake right buddy,
+ *    whose size is 0.  The other left buddies are followed by their right
+ *    buddy.
+ *  RETURN VALUE
+ *    The chunk if the item is the top item of its chunk, NULL otherwise.
+ ******
+ */
+
+struct chunk*
+item_get_chunk(void *item)
+{
+    char *next = (char*)item + item_get_size(item) * BLOCK_SIZE;
+    if (item_get_lr_bit(item) == LEFT && item_get_size(next) == 0)
+    {
+        return (struct chunk*)((char*)item - sizeof(struct chunk));
+    }
+    return NULL;
+}
+
+
+/* the chunk of the heap, of its mem_list or of a direct area, whose
+ * items hold the address p, or NULL
+ */
+static struct chunk*
+heap_find_chunk(struct mem_heap *heap, void *p)
+{
+    struct chunk_entry *entry;
+    struct chunk *chunk = NULL;
+    INDEX_LOCK();
+    entry = index_find(p);
+    if (entry != NULL && entry->heap == heap
+        && (char*)p >= (char*)entry->chunk + sizeof(struct chunk))
+    {
+        chunk = entry->chunk;
+    }
+    INDEX_UNLOCK();
+    return chunk;
+}
+
+
+/****f* mem/heap_release_chunk
+ *  NAME
+ *    heap_release_chunk - return a free chunk to the OS
+ *  SYNOPSIS
+ *    void heap_release_chunk(struct mem_heap *heap, struct chunk *chunk)
+ *  DESCRIPTION
+ *    The top item of the chunk, which must be free, is removed from its
+ *    free list, the chunk is removed from the mem_list of the heap and
+ *    given back to the chunk source.
+ *  RETURN VALUE
+ *    This function returns nothing.
+ ******
+ */
+
+void
+heap_release_chunk(struct mem_heap *heap, struct chunk *chunk)
+{
+    void *item = (char*)chunk + sizeof(struct chunk);
+    debug("release chunk %p, %d bytes\n", (void*)chunk, (int)chunk->size);
+    delete_item(&heap->array,
+        class_index(item_get_size(item)), item);
+    heap->free_chunk_bytes -= chunk->size;
+    heap->chunk_bytes -= chunk->size;
+    heap->chunk_count--;
+    if (chunk->prev != NULL)
+    {
+        chunk->prev->next = chunk->next;
+    }
+    else
+    {
+        heap->mem_list = chunk->next;
+    }
+    if (chunk->next != NULL)
+    {
+        chunk->next->prev = chunk->prev;
+    }
+    index_remove(chunk);
+    chunk_free(chunk);
+}
+
+
+/****f* mem/heap_trim
+ *  NAME
+ *    heap_trim - return free chunks to the OS
+ *  SYNOPSIS
+ *    void heap_trim(struct mem_heap *heap, size_t keep)
+ *  DESCRIPTION
+ *    Goes through the mem_list of the heap and returns the chunks whose top
+ *    item is free to the OS, as long as the heap keeps more than keep bytes
+ *    of free chunks.
+ *  RETURN VALUE
+ *    This function returns nothing.
+ ******
+ */
+
+void
+heap_trim(struct mem_heap *heap, size_t keep)
+{
+    struct chunk *chunk, *next;
+    void *item;
+    chunk = heap->mem_list;
+    while (chunk != NULL && heap->free_chunk_bytes > keep)
+    {
+        next = chunk->next;
+        item = (char*)chunk + sizeof(struct chunk);
+        if (!item_is_in_use(item) && item_get_chunk(item) == chunk)
+        {
+            heap_release_chunk(heap, chunk);
+        }
+        chunk = next;
+    }
+}
+
+
+/****f* mem/alloc_new_item
+ *  NAME
+ *    alloc_new_item - allocate a new item from the OS
+ *  SYNOPSIS
+ *    void *alloc_new_item(struct mem_heap *heap, uintptr_t n,
+ *        size_t align);
+ *  DESCRIPTION
+ *    The function alloc_new_item allocates a new item of n blocks.  It also
+ *    allocates a fake empty buddy, so that it does not merge more than it
+ *    should.  The fake right buddy is marked in use in order to stop the
+ *    merging of buddies.
+ *
+ *    The whole thing is prefixed by a chunk structure in order to make it a
+ *    singly linked list, the mem_list of the heap, which is used to free
+ *    all the elements allocated from the OS.  The memory comes from
+ *    chunk_alloc, which aligns the area of the item on align bytes if
+ *    align is not 0.
+ *
+ *    The number passed in the n parameter is always a number belonging to
+ *    the generalized Fibonacci sequence.
+ *  RETURN VALUE
+ *    This function returns the address of new item allocated, or NULL if
+ *    the OS has no more memory.
+ ******
+ */
+
+void*
+alloc_new_item(struct mem_heap *heap, uintptr_t n, size_t align)
+{
+    void *fake_right, *item;
+    struct chunk *chunk;
+    size_t size = sizeof(struct chunk) + BLOCK_SIZE * (size_t)n + HEADER_SIZE;
+    debug("alloc_new_item: allocate %lu blocks, %lu bytes\n",
+        (unsigned long)n, (unsigned long)size);
+    chunk = chunk_alloc(size, align);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    if (!index_add(heap, chunk))
+    {
+        chunk_free(chunk);
+        return NULL;
+    }
+    heap->chunk_bytes += chunk->size;
+    heap->chunk_count++;
+    chunk->next = heap->mem_list;
+    chunk->prev = NULL;
+    if (heap->mem_list != NULL)
+    {
+        heap->mem_list->prev = chunk;
+    }
+    heap->mem_list = chunk;
+    fake_right = ((char*)chunk) + sizeof(struct chunk) + BLOCK_SIZE * n;
+    ((uintptr_t*)fake_right)[0] = 0;
+    item_set_lr_bit(fake_right, RIGHT);
+    item_set_in_use(fake_right, 1);
+    item = ((char*)chunk) + sizeof(struct chunk);
+    ((uintptr_t*)item)[0] = 0;
+    item_set_size(item, n);
+    item_set_lr_bit(item, LEFT);
+    return item;
+}
+
+
+/****f* mem/direct_alloc
+ *  NAME
+ *    direct_alloc - allocate an area in a chunk of its own
+ *  SYNOPSIS
+ *    void *direct_alloc(struct mem_heap *heap, size_t x, size_t align)
+ *  DESCRIPTION
+ *    The areas of DIRECT_MIN_BYTES or more do not go through the array:
+ *    splitting a chunk for them would keep big free buddies in the heap
+ *    after they are freed.  Each gets a chunk of the exact size from
+ *    chunk_alloc, holding the chunk structure and an item whose header is
+ *    0 but for the in_use bit, so that item_is_direct tells it apart, and
+ *    free_item returns the chunk to the OS at once.  The area is aligned
+ *    on align bytes if it is not 0, and always on 2 words.
+ *
+ *    The chunk is linked into the direct_list of the heap, apart from the
+ *    mem_list, and does not count in chunk_bytes, so that it does not make
+ *    the next chunks of the heap grow.
+ *  RETURN VALUE
+ *    The item of the area, or NULL if x is too big or the OS has no more
+ *    memory.
+ ******
+ */
+
+void*
+direct_alloc(struct mem_heap *heap, size_t x, size_t align)
+{
+    struct chunk *chunk;
+    void *item;
+    if (x > SIZE_MAX / 2 || align > SIZE_MAX / 4)
+    {
+        return NULL;
+    }
+    if (align < 2 * HEADER_SIZE)
+    {
+        align = 2 * HEADER_SIZE;
+    }
+    chunk = chunk_alloc(sizeof(struct chunk) + HEADER_SIZE + x, align);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    if (!index_add(heap, chunk))
+    {
+        chunk_free(chunk);
+        return NULL;
+    }
+    debug("direct_alloc: %lu bytes\n", (unsigned long)chunk->size);
+    chunk->prev = NULL;
+    chunk->next = heap->direct_list;
+    if (heap->direct_list != NULL)
+    {
+        heap->direct_list->prev = chunk;
+    }
+    heap->direct_list = chunk;
+    heap->direct_count++;
+    heap->direct_bytes += chunk->size;
+    item = (char*)chunk + sizeof(struct chunk);
+    ((uintptr_t*)item)[0] = 0;
+    item_set_in_use(item, 1);
+    return item;
+}
+
+
+/* returns the chunk of a direct area to the OS */
+void
+direct_free(struct mem_heap *heap, void *item)
+{
+    struct chunk *chunk = direct_get_chunk(item);
+    if (chunk->prev != NULL)
+    {
+        chunk->prev->next = chunk->next;
+    }
+    else
+    {
+        heap->direct_list = chunk->next;
+    }
+    if (chunk->next != NULL)
+    {
+        chunk->next->prev = chunk->prev;
+    }
+    heap->direct_count--;
+    heap->direct_bytes -= chunk->size;
+    index_remove(chunk);
+    chunk_free(chunk);
+}
+
+
+/* allocates the item of an area of x bytes, with room for the canary in
+ * the hardened mode, a direct area if x is big
+ */
+static void*
+heap_alloc_item(struct mem_heap *heap, size_t x)
+{
+    x = harden_bytes(x);
+    if (x >= DIRECT_MIN_BYTES)
+    {
+        return direct_alloc(heap, x, 0);
+    }
+    return alloc_item(heap, BLOCKS(x + HEADER_SIZE));
+}
+
+
+#if MEM_ALLOC_HARDEN
+
+/* the word at the end of the area of an item, holding the size asked */
+static inline char*
+harden_size_word(void *item)
+{
+    return (char*)item_get_area(item) + item_get_bytes(item)
+        - sizeof(size_t);
+}
+
+
+/****f* mem/harden_alloc
+ *  NAME
+ *    harden_alloc - prepare the area of an item just allocated
+ *  SYNOPSIS
+ *    void harden_alloc(void *item, size_t from, size_t x)
+ *  DESCRIPTION
+ *    In the hardened mode the item was allocated for harden_bytes(x)
+ *    bytes.  The bytes of the area from from to x, those the caller did
+ *    not write yet, are filled with ALLOC_FILL, so that reading them
+ *    before writing them shows, except in a direct area, whose pages are
+ *    not touched.  They are followed by CANARY_BYTES bytes of
+ *    CANARY_FILL, and the last word of the area holds x.  The word is
+ *    copied with memcpy, as the area is only aligned on a word.
+ *  RETURN VALUE
+ *    Does not return anything.
+ ******
+ */
+
+static void
+harden_alloc(void *item, size_t from, size_t x)
+{
+    char *area = item_get_area(item);
+    if (from < x && !item_is_direct(item))
+    {
+        memset(area + from, ALLOC_FILL, x - from);
+    }
+    memset(area + x, CANARY_FILL, CANARY_BYTES);
+    memcpy(harden_size_word(item), &x, sizeof(size_t));
+}
+
+
+/* prints the problem found with an item and stops the program */
+static void
+harden_fail(void *item, const char *problem)
+{
+    fprintf(stderr, "mem: %s at %p\n", problem, item_get_area(item));
+    abort();
+}
+
+
+/****f* mem/harden_check
+ *  NAME
+ *    harden_check - check an item given back by the caller
+ *  SYNOPSIS
+ *    size_t harden_check(struct mem_heap *heap, void *item)
+ *  DESCRIPTION
+ *    Before an item is freed or reallocated in the hardened mode, checks
+ *    that the chunk index finds it in a chunk of the mem_list of the heap,
+ *    at a multiple of BLOCK_SIZE from its first item, or that it is the
+ *    item of a direct area of the heap, that it is in use, that it was
+ *    not already freed, and that the canary after its size is intact.  An
+ *    item of the lazy lists or of the cache of a thread is still in use,
+ *    but its size word was set to HARDEN_FREED by harden_free.  The heap
+ *    must be locked.
+ *  RETURN VALUE
+ *    The size asked for the item.  The program is aborted with a message
+ *    on stderr if a check fails.
+ ******
+ */
+
+static size_t
+harden_check(struct mem_heap *heap, void *item)
+{
+    struct chunk *chunk;
+    char *canary;
+    size_t x;
+    unsigned int k;
+    chunk = heap_find_chunk(heap, item);
+    if (chunk == NULL)
+    {
+        harden_fail(item, "free of an area not allocated by the heap");
+    }
+    if (item_is_direct((char*)chunk + sizeof(struct chunk))
+        ? direct_get_chunk(item) != chunk
+        : ((size_t)((char*)item - (char*)chunk) - sizeof(struct chunk))
+            % BLOCK_SIZE != 0 || item_is_direct(item))
+    {
+        harden_fail(item, "free of a pointer inside an item");
+    }
+    if (!item_is_in_use(item))
+    {
+        harden_fail(item, "double free");
+    }
+    memcpy(&x, harden_size_word(item), sizeof(size_t));
+    if (x == HARDEN_FREED)
+    {
+        harden_fail(item, "double free");
+    }
+    if (x > item_get_bytes(item) - HARDEN_EXTRA)
+    {
+        harden_fail(item, "size word overwritten");
+    }
+    canary = (char*)item_get_area(item) + x;
+    for (k = 0; k < CANARY_BYTES; k++)
+    {
+        if ((unsigned char)canary[k] != CANARY_FILL)
+        {
+            harden_fail(item, "canary overwritten, overflow");
+        }
+    }
+    return x;
+}
+
+
+/****f* mem/harden_free
+ *  NAME
+ *    harden_free - check and fill an item being freed
+ *  SYNOPSIS
+ *    void harden_free(struct mem_heap *heap, void *item)
+ *  DESCRIPTION
+ *    Checks the item with harden_check, then fills its area with
+ *    FREE_FILL, so that a use after free reads garbage, except in a
+ *    direct area, which is unmapped at once.  The size word is set to
+ *    HARDEN_FREED.  The heap must be locked.
+ *  RETURN VALUE
+ *    Does not return anything.
+ ******
+ */
+
+static void
+harden_free(struct mem_heap *heap, void *item)
+{
+    size_t freed = HARDEN_FREED;
+    harden_check(heap, item);
+    if (!item_is_direct(item))
+    {
+        memset(item_get_area(item), FREE_FILL,
+            item_get_bytes(item) - sizeof(size_t));
+    }
+    memcpy(harden_size_word(item), &freed, sizeof(size_t));
+}
+
+#endif /* MEM_ALLOC_HARDEN */
+
+
+/****f* mem/heap_chunk_class
+ *  NAME
+ *    heap_chunk_class - choose the class of a new chunk
+ *  SYNOPSIS
+ *    unsigned int heap_chunk_class(struct mem_heap *heap, uintptr_t n)
+ *  DESCRIPTION
+ *    The new chunk must hold n blocks.  It is also at least
+ *    min_chunk_bytes, and at least the size of all the chunks of the heap
+ *    shifted right by growth_shift, so that the chunks grow geometrically
+ *    with the heap.
+ *  RETURN VALUE
+ *    The index of the class of the new chunk, or CLASS_COUNT if no class
+ *    is big enough.
+ ******
+ */
+
+unsigned int
+heap_chunk_class(struct mem_heap *heap, uintptr_t n)
+{
+    size_t bytes = heap->chunk_bytes >> heap->growth_shift;
+    uintptr_t blocks;
+    if (bytes < heap->min_chunk_bytes)
+    {
+        bytes = heap->min_chunk_bytes;
+    }
+    blocks = BLOCKS(bytes);
+    if (blocks < n)
+    {
+        blocks = n;
+    }
+    return class_index(blocks);
+}
+
+
+/****f* mem/alloc_item
+ *  NAME
+ *    alloc_item - allocate an item of a minimum number of blocks
+ *  SYNOPSIS
+ *    void *alloc_item(struct mem_heap *heap, uintptr_t n)
+ *  DESCRIPTION
+ *    Allocates an item of minimum n blocks, header included, from the
+ *    heap.
+ *
+ *    In the lazy mode an unmerged item of the class of n is taken first,
+ *    it needs neither a split nor a search.
+ *
+ *    First we check if the array contains an element that we can use in
+ *    order to hold n blocks.  The bitmap of the array gives the first
+ *    non-empty free list starting from the smallest size that fits.
+ *
+ *    If such element is found we remove it from
+ *    the array.
+ *
+ *    Otherwise we allocate the area from the OS.  The size of the new
+ *    chunk is chosen by heap_chunk_class, it is usually bigger than
+ *    needed, and what is not used is put in the free lists by the split.
+ *
+ *    If the item taken is a whole free chunk, it is not free anymore.
+ *
+ *    Once we have the item, we split it as much as needed.  Then we set the
+ *    in_use bit of the item and return it.
+ *  RETURN VALUE
+ *    An item of minimum n blocks, or NULL if the heap cannot grow.
+ ******
+ */
+
+void*
+alloc_item(struct mem_heap *heap, uintptr_t n)
+{
+    unsigned int i;
+    void *item;
+    struct array *array = &heap->array;
+
+    // an unmerged item of the class is used as it is
+    i = class_index(n);
+    if (i < CLASS_COUNT && heap->unmerged[i] != NULL)
+    {
+        item = heap->unmerged[i];
+        heap->unmerged[i] = item_get_next(item);
+        heap->unmerged_count[i]--;
+        heap->unmerged_items--;
+        array->data[i].used_count++;
+        return item;
+    }
+
+    // try to find a free item
+    i = heap_find_free(heap, i);
+
+    // if not found, then allocate a new chunk
+    if (i == CLASS_COUNT)
+    {
+        i = heap_chunk_class(heap, n);
+        if (i == CLASS_COUNT)
+        {
+            return NULL;
+        }
+        item = alloc_new_item(heap, class_sizes[i], 0);
+        if (item == NULL)
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        struct chunk *chunk;
+        item = take_item(array, i);
+        chunk = item_get_chunk(item);
+        if (chunk != NULL)
+        {
+            heap->free_chunk_bytes -= chunk->size;
+        }
+    }
+
+    // split if needed to
+    item = split_item(array, &i, item, n);
+    item_set_in_use(item, 1);
+    array->data[i].used_count++;
+    return item;
+}
+
+
+/****f* mem/carve_items
+ *  NAME
+ *    carve_items - split a free item into many items of the same size
+ *  SYNOPSIS
+ *    unsigned int carve_items(struct array *array, void *item,
+ *        unsigned int i, uintptr_t n, void **out, unsigned int count)
+ *  DESCRIPTION
+ *    Splits the item of the class i, which is in no free list, in a single
+ *    depth-first pass, the left buddies first, and puts into out the items
+ *    split_item would stop at for n blocks, until there are count of them.
+ *    The buddies smaller than n blocks go to the free lists.
+ *
+ *    When out is full, the right buddies still waiting are inserted into
+ *    the free lists and merged with their free buddies, the last split
+ *    first.  They are marked in use until then, so that a merge does not
+ *    take one which is not in a free list yet.
+ *  RETURN VALUE
+ *    The number of items put into out, which are in use.
+ ******
+ */
+
+unsigned int
+carve_items(struct array *array, void *item, unsigned int i, uintptr_t n,
+    void **out, unsigned int count)
+{
+    void *stack[CLASS_COUNT];
+    unsigned int classes[CLASS_COUNT];
+    unsigned int top = 0, k = 0;
+    for (;;)
+    {
+        if (class_sizes[i] < n)
+        {
+            insert_item(array, i, item);
+        }
+        else if (i <= FIB_K || class_sizes[i-1] < n)
+        {
+            item_set_in_use(item, 1);
+            array->data[i].used_count++;
+            out[k++] = item;
+        }
+        else
+        {
+            stack[top] = split_buddies(array, item, i);
+            classes[top++] = i - 1;
+            i = i - FIB_K;
+            continue;
+        }
+        if (top == 0 || k == count)
+        {
+            break;
+        }
+        top--;
+        item = stack[top];
+        i = classes[top];
+    }
+    for (i = 0; i < top; i++)
+    {
+        item_set_in_use(stack[i], 1);
+    }
+    while (top > 0)
+    {
+        top--;
+        item_set_in_use(stack[top], 0);
+        insert_item(array, classes[top], stack[top]);
+        coalesce(array, classes[top]);
+    }
+    return k;
+}
+
+
+/****f* mem/alloc_items
+ *  NAME
+ *    alloc_items - allocate many items of the same size
+ *  SYNOPSIS
+ *    unsigned int alloc_items(struct mem_heap *heap, uintptr_t n,
+ *        unsigned int count, void **out)
+ *  DESCRIPTION
+ *    Fills out with count items of minimum n blocks.  The unmerged items
+ *    and the free items of the class of n are taken first, as they need no
+ *    split.  Then a free
+ *    item big enough for all the remaining items is carved by carve_items,
+ *    or the biggest free item when none is, or a new chunk when no free
+ *    item holds n blocks.
+ *  RETURN VALUE
+ *    The number of items put into out, less than count only if the heap
+ *    cannot grow or the remaining items would need more than a uintptr_t
+ *    of blocks.
+ ******
+ */
+
+unsigned int
+alloc_items(struct mem_heap *heap, uintptr_t n, unsigned int count,
+    void **out)
+{
+    struct array *array = &heap->array;
+    struct chunk *chunk;
+    unsigned int c, i, j, k = 0;
+    uintptr_t need, size;
+    void *item;
+    c = class_index(n);
+    while (k < count && c < CLASS_COUNT && heap->unmerged[c] != NULL)
+    {
+        item = heap->unmerged[c];
+        heap->unmerged[c] = item_get_next(item);
+        heap->unmerged_count[c]--;
+        heap->unmerged_items--;
+        array->data[c].used_count++;
+        out[k++] = item;
+    }
+    while (k < count)
+    {
+        c = class_index(n);
+        i = heap_find_free(heap, c);
+        size = c < CLASS_COUNT ? class_sizes[c] : n;
+        if (count - k > UINTPTR_MAX / size)
+        {
+            break;                              // more than memory holds
+        }
+        need = (count - k) * size;
+        if (i != c && i < CLASS_COUNT)
+        {
+            // one item for all the remaining items, or the biggest one
+            j = array_find_nonempty(array, class_index(need));
+            if (j < CLASS_COUNT)
+            {
+                i = j;
+            }
+            else
+            {
+                for (j = i; j < CLASS_COUNT;
+                    j = array_find_nonempty(array, j + 1))
+                {
+                    i = j;
+                }
+            }
+        }
+        if (i == CLASS_COUNT)
+        {
+            i = heap_chunk_class(heap, need);
+            if (i == CLASS_COUNT && need > n)
+            {
+                i = heap_chunk_class(heap, n);      // one item at a time
+            }
+            if (i == CLASS_COUNT)
+            {
+                break;
+            }
+            item = alloc_new_item(heap, class_sizes[i], 0);
+            if (item == NULL)
+            {
+                break;
+            }
+        }
+        else
+        {
+            item = take_item(array, i);
+            chunk = item_get_chunk(item);
+            if (chunk != NULL)
+            {
+                heap->free_chunk_bytes -= chunk->size;
+            }
+        }
+        k += carve_items(array, item, i, n, out + k, count - k);
+    }
+    return k;
+}
+
+
+/****f* mem/aligned_find
+ *  NAME
+ *    aligned_find - search the split tree of an item for an aligned item
+ *  SYNOPSIS
+ *    char *aligned_find(struct array *array, char *item, unsigned int i,
+ *        uintptr_t n, uintptr_t align, unsigned int *budget)
+ *  DESCRIPTION
+ *    The items that splitting a free item of the class i can give form a
+ *    tree: the left buddy is at the address of its parent and the right
+ *    buddy follows it.  The tree is searched, left buddies first, for an
+ *    item of minimum n blocks whose area is aligned on align bytes.
+ *    Nothing is split, and at most *budget items are looked at.
+ *  RETURN VALUE
+ *    The address of the item found, or NULL.
+ ******
+ */
+
+char*
+aligned_find(struct array *array, char *item, unsigned int i, uintptr_t n,
+    uintptr_t align, unsigned int *budget)
+{
+    char *found;
+    if (class_sizes[i] < n || *budget == 0)
+    {
+        return NULL;
+    }
+    (*budget)--;
+    if (((uintptr_t)item + HEADER_SIZE) % align == 0)
+    {
+        return item;
+    }
+    if (i <= FIB_K)
+    {
+        return NULL;
+    }
+    found = aligned_find(array, item, i - FIB_K, n, align, budget);
+    if (found == NULL)
+    {
+        found = aligned_find(array,
+            item + class_sizes[i-FIB_K] * BLOCK_SIZE, i - 1, n, align,
+            budget);
+    }
+    return found;
+}
+
+
+/****f* mem/split_aligned
+ *  NAME
+ *    split_aligned - split an item down to an item found by aligned_find
+ *  SYNOPSIS
+ *    void *split_aligned(struct array *array, unsigned int *pi, void *item,
+ *        char *target, uintptr_t n)
+ *  DESCRIPTION
+ *    Like split_item, but at each step the buddy which contains the
+ *    target is kept.  Once the target is reached, it is split further as
+ *    long as its left buddy, at the same address, holds n blocks.
+ *  RETURN VALUE
+ *    The target item, with its class in *pi.
+ ******
+ */
+
+void*
+split_aligned(struct array *array, unsigned int *pi, void *item,
+    char *target, uintptr_t n)
+{
+    char *curr = item, *right;
+    unsigned int i = *pi;
+    while (i > FIB_K && (curr != target || class_sizes[i-FIB_K] >= n))
+    {
+        right = split_buddies(array, curr, i);
+        if (target < right)
+        {
+            insert_item(array, i - 1, right);
+            i = i - FIB_K;
+        }
+        else
+        {
+            insert_item(array, i - FIB_K, curr);
+            i = i - 1;
+            curr = right;
+        }
+    }
+    *pi = i;
+    return curr;
+}
+
+
+/****f* mem/alloc_aligned_item
+ *  NAME
+ *    alloc_aligned_item - allocate an item whose area is aligned
+ *  SYNOPSIS
+ *    void *alloc_aligned_item(struct mem_heap *heap, uintptr_t n,
+ *        uintptr_t align)
+ *  DESCRIPTION
+ *    Allocates an item of minimum n blocks whose area is aligned on align
+ *    bytes, a power of 2.  The free items big enough are searched with
+ *    aligned_find, the smallest classes first, sharing ALIGN_BUDGET items
+ *    looked at.  If none contains an aligned item, a new chunk is added to
+ *    the heap, placed so that the area of its top item is aligned.  Its
+ *    size is min_chunk_bytes, or n blocks if more, because growing with
+ *    the heap would make it grow at each miss.  The item found is split
+ *    out of the free item containing it and the other buddies go to the
+ *    free lists.
+ *  RETURN VALUE
+ *    An item of minimum n blocks with an aligned area, or NULL if the heap
+ *    cannot grow.
+ ******
+ */
+
+void*
+alloc_aligned_item(struct mem_heap *heap, uintptr_t n, uintptr_t align)
+{
+    struct array *array = &heap->array;
+    struct chunk *chunk;
+    unsigned int i, k, budget;
+    char *item, *target = NULL;
+
+    do
+    {
+        i = array_find_nonempty(array, class_index(n));
+        while (i < CLASS_COUNT && target == NULL)
+        {
+            item = array->data[i].items;
+            for (k = 0; k < ALIGN_ITEMS && item != NULL; k++)
+            {
+                budget = ALIGN_BUDGET;
+                target = aligned_find(array, item, i, n, align, &budget);
+                if (target != NULL)
+                {
+                    break;
+                }
+                item = item_get_next(item);
+            }
+            if (target == NULL)
+            {
+                i = array_find_nonempty(array, i + 1);
+            }
+        }
+    } while (target == NULL && merge_all(heap));
+    if (target != NULL)
+    {
+        delete_item(array, i, item);
+        chunk = item_get_chunk(item);
+        if (chunk != NULL)
+        {
+            heap->free_chunk_bytes -= chunk->size;
+        }
+    }
+    else
+    {
+        if (array_find_nonempty(array, class_index(n)) == CLASS_COUNT)
+        {
+            i = heap_chunk_class(heap, n);      // the heap is full
+        }
+        else
+        {
+            i = class_index(n);     // the heap has free items, not aligned
+        }
+        if (i == CLASS_COUNT)
+        {
+            return NULL;
+        }
+        item = alloc_new_item(heap, class_sizes[i], align);
+        if (item == NULL)
+        {
+            return NULL;
+        }
+        target = item;
+    }
+
+    item = split_aligned(array, &i, item, target, n);
+    item_set_in_use(item, 1);
+    array->data[i].used_count++;
+    return item;
+}
+
+
+/****f* mem/item_get_buddy
+ *  NAME
+ *    item_get_buddy - given an item, return its buddy
+ *  SYNOPSIS
+ *  void *item_get_buddy(struct array *array, void *item, unsigned int i,
+ *      unsigned int *ibuddy);
+ *  DESCRIPTION
+ *    Calculates the address of the buddy and returns it.  It uses the fact
+ *    that the free list containing the size of the buddy is either k - 1
+ *    cells to the left or k - 1 cells to the right, depending on whether
+ *    the item is is a left or the right buddy.  Then, knowing the size,
+ *    it's easy to know the location of the buddy.
+ *  RETURN VALUE
+ *    The function retuens the address of the buddy.  It also sets the
+ *    address pointed by ibuddy, which corresponds to the index in the array
+ *    where it would be inserted.  That is, the index of the array that
+ *    gives the location of the free list of the same size as the buddy.
+ ******
+ */
+
+void*
+item_get_buddy(struct array *array, void *item, unsigned int i,
+    unsigned int *ibuddy)
+{
+    uintptr_t size, buddy_size;
+    if (item_get_lr_bit(item) == LEFT)
+    {
+        *ibuddy = i + FIB_K - 1;
+        size = item_get_size(item);
+        return ((char*)item) + size * BLOCK_SIZE;
+    }
+    else
+    {
+        *ibuddy = i - (FIB_K - 1);
+        buddy_size = class_sizes[*ibuddy];
+        return ((char*)item) - buddy_size * BLOCK_SIZE;
+    }
+}
+
+
+/****f* mem/delete_item
+ *  NAME
+ *    delete_item - delete an item from the free list at a specified index
+ *  SYNOPSIS
+ *    void delete_item(struct array *array, unsigned int i, void *item)
+ *  DESCRIPTION
+ *    The function delete_item deletes one item from the free list
+ *    specified by the index i in the array.  The item must be in this free
+ *    list.  The delete operation is like a normal delete operation from a
+ *    doubly linked list, using the prev and next pointers of the item
+ *    itself, except that if it's the first item, then the entry in the
+ *    array is modified to point to the new head.
+ *
+ *    It is different from take_item, which removes any item from the free
+ *    list.  The item deleted from the list can still be used (it is not
+ *    freed), and can be inserted back.
+ *  RETURN VALUE
+ *    Does not return anything
+ ******
+ */
+
+void
+delete_item(struct array *array, unsigned int i, void *item)
+{
+    void *prev = item_get_prev(item);
+    void *next = item_get_next(item);
+    array->data[i].free_count--;
+    if (prev != NULL)
+    {
+        item_set_next(prev, next);
+    }
+    else
+    {
+        array->data[i].items = next;
+        if (next == NULL)
+        {
+            array_set_nonempty(array, i, 0);
+        }
+    }
+    if (next != NULL)
+    {
+        item_set_prev(next, prev);
+    }
+}
+
+
+/****f* mem/coalesce
+ *  NAME
+ *    coalesce - merge buddies until an buddy in use is found.
+ *  DESCRIPTION
+ *    The coalesce function makes the opposite of splitting: it merges
+ *    buddies that are not in use, and stops when it finds a buddy which is
+ *    in use, which will happen sooner or later because the item at the top
+ *    had a fake right buddy which is marked in use.
+ *  SYNOPSIS 
+ *    unsigned int coalesce(struct array *array, unsigned int);
+ *  RETURN VALUE
+ *    The index of the free list of the merged item, which is the first
+ *    item of this list.
+ ******
+ */
+
+unsigned int
+coalesce(struct array *array, unsigned int i)
+{
+    unsigned int ibuddy;
+    void *item, *buddy, *left, *right;
+    boolean lr_bit, inh_bit;
+    uintptr_t size;
+    item = array->data[i].items;
+    buddy = item_get_buddy(array, item, i, &ibuddy);
+    while (!item_is_in_use(buddy)
+        && class_sizes[ibuddy] == item_get_size(buddy))
+    {
+        delete_item(array, i, item);
+        delete_item(array, ibuddy, buddy);
+        array->merges++;
+        if (item_get_lr_bit(item) == LEFT)
+        {
+            left = item;
+            right = buddy;
+            i += FIB_K;
+        }
+        else
+        {
+            left = buddy;
+            right = item;
+            i += 1;
+        }
+        item = left;
+        size = class_sizes[i];	// new i
+        lr_bit = item_get_inh_bit(left);
+        inh_bit = item_get_inh_bit(right);
+        item_set_lr_bit(item, lr_bit);
+        item_set_inh_bit(item, inh_bit);
+        item_set_size(item, size);
+        item_set_in_use(item, 0);
+        buddy = item_get_buddy(array, item, i, &ibuddy);
+        insert_item(array, i, item);
+    }
+    return i;
+}
+
+
+/****f* mem/merge_unmerged
+ *  NAME
+ *    merge_unmerged - merge the unmerged items of a class
+ *  SYNOPSIS
+ *    void merge_unmerged(struct mem_heap *heap, unsigned int i,
+ *        unsigned int keep)
+ *  DESCRIPTION
+ *    Takes the unmerged items of the class i, the last freed first, and
+ *    merges them by merge_item, until keep of them are left.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+merge_unmerged(struct mem_heap *heap, unsigned int i, unsigned int keep)
+{
+    void *item;
+    while (heap->unmerged_count[i] > keep)
+    {
+        item = heap->unmerged[i];
+        heap->unmerged[i] = item_get_next(item);
+        heap->unmerged_count[i]--;
+        heap->unmerged_items--;
+        merge_item(heap, item, i);
+    }
+}
+
+
+/* merges all the unmerged items of the heap, returns 0 if there were none */
+boolean
+merge_all(struct mem_heap *heap)
+{
+    unsigned int i;
+    if (heap->unmerged_items == 0)
+    {
+        return 0;
+    }
+    for (i = 0; i < CLASS_COUNT; i++)
+    {
+        merge_unmerged(heap, i, 0);
+    }
+    return 1;
+}
+
+
+/* the first non-empty free list from the class c, the unmerged items are
+ * merged first if none is
+ */
+unsigned int
+heap_find_free(struct mem_heap *heap, unsigned int c)
+{
+    unsigned int i = array_find_nonempty(&heap->array, c);
+    if (i == CLASS_COUNT && merge_all(heap))
+    {
+        i = array_find_nonempty(&heap->array, c);
+    }
+    return i;
+}
+
+
+/****f* mem/free_item
+ *  NAME
+ *    free_item - put the item back into the free list
+ *  SYNOPSIS
+ *    void free_item(struct mem_heap *heap, void *item)
+ *  DESCRIPTION
+ *    Return the item after use to the free list.  Using the header, it's
+ *    easy to find the size, and, having found the size, we have the index
+ *    which must match the size field of a free list in the array.  The
+ *    index is computed from the highest bit of the size.  Then the item is
+ *    merged with its free buddies by merge_item.
+ *
+ *    In the lazy mode the item is only pushed on the unmerged list of its
+ *    class, and the list is merged by merge_unmerged when it is too long.
+ *    The item of a direct area has no class, its chunk is returned to the
+ *    OS by direct_free.
+ *  RETURN VALUE
+ *    Does not return anything.
+ ******
+ */
+
+void
+free_item(struct mem_heap *heap, void *item)
+{
+    unsigned int i;
+    struct array *array = &heap->array;
+    if (item_is_direct(item))
+    {
+        direct_free(heap, item);
+        return;
+    }
+    i = class_index(item_get_size(item));
+    array->data[i].used_count--;
+    if (heap->lazy_max > 0)
+    {
+        item_set_next(item, heap->unmerged[i]);
+        heap->unmerged[i] = item;
+        heap->unmerged_items++;
+        if (++heap->unmerged_count[i] > heap->lazy_max)
+        {
+            merge_unmerged(heap, i, heap->lazy_max / 2);
+        }
+        return;
+    }
+    merge_item(heap, item, i);
+}
+
+
+/****f* mem/merge_item
+ *  NAME
+ *    merge_item - insert a free item and merge it with its buddies
+ *  SYNOPSIS
+ *    void merge_item(struct mem_heap *heap, void *item, unsigned int i)
+ *  DESCRIPTION
+ *    The item of the class i, which is not counted as used anymore, is
+ *    inserted into its free list and merged with its free buddies.  If
+ *    this gives a whole chunk, the chunk becomes free, and the free chunks
+ *    can be returned to the OS according to the retention policy of the
+ *    heap.
+ *  RETURN VALUE
+ *    Does not return anything.
+ ******
+ */
+
+void
+merge_item(struct mem_heap *heap, void *item, unsigned int i)
+{
+    struct chunk *chunk;
+    struct array *array = &heap->array;
+    item_set_in_use(item, 0);
+    insert_item(array, i, item);
+    i = coalesce(array, i);
+    chunk = item_get_chunk(array->data[i].items);
+    if (chunk != NULL)
+    {
+        heap->free_chunk_bytes += chunk->size;
+        if (heap->free_chunk_bytes > heap->release_threshold)
+        {
+            // the chunk just freed first, then the others if needed
+            heap_release_chunk(heap, chunk);
+            if (heap->free_chunk_bytes > heap->retain_bytes)
+            {
+                heap_trim(heap, heap->retain_bytes);
+            }
+        }
+    }
+}
+
+
+/****f* mem/shrink_item
+ *  NAME
+ *    shrink_item - split an item in use keeping its left part
+ *  SYNOPSIS
+ *    unsigned int shrink_item(struct array *array, unsigned int i,
+ *        void *item, uintptr_t n)
+ *  DESCRIPTION
+ *    Like split_item, but the item stays where it is: as long as the left
+ *    buddy can hold n blocks, the item is split, the right buddy is
+ *    inserted into the free list and the item becomes the left buddy.  The
+ *    right buddies do not need to be merged, their buddy is the item,
+ *    which is in use.
+ *  RETURN VALUE
+ *    The index of the new size of the item.
+ ******
+ */
+
+unsigned int
+shrink_item(struct array *array, unsigned int i, void *item, uintptr_t n)
+{
+    void *right;
+    while (i > FIB_K && class_sizes[i-FIB_K] >= n)
+    {
+        array->splits++;
+        right = ((char*)item) + class_sizes[i-FIB_K] * BLOCK_SIZE;
+        item_set_size(right, class_sizes[i-1]);
+        item_set_lr_bit(right, RIGHT);
+        item_set_inh_bit(right, item_get_inh_bit(item));
+        item_set_in_use(right, 0);
+        insert_item(array, i - 1, right);
+        item_set_size(item, class_sizes[i-FIB_K]);
+        item_set_inh_bit(item, item_get_lr_bit(item));
+        item_set_lr_bit(item, LEFT);
+        i -= FIB_K;
+    }
+    return i;
+}
+
+
+/****f* mem/grow_item
+ *  NAME
+ *    grow_item - merge an item in use with its free right buddies
+ *  SYNOPSIS
+ *    boolean grow_item(struct array *array, unsigned int *i, void *item,
+ *        uintptr_t n)
+ *  DESCRIPTION
+ *    An item which is a left buddy can grow without moving if its right
+ *    buddy is free and has the size of the class i + k - 1: merging them
+ *    gives the parent, of class i + k, at the same address.  If the parent
+ *    is itself a left buddy, it can go on.  First the whole path is checked
+ *    without changing anything, the lr_bit of each parent being the inh_bit
+ *    of its left child, then, if the item can reach n blocks, the buddies
+ *    are removed from the free lists and the item takes the new size.
+ *  RETURN VALUE
+ *    Whether the item now holds n blocks.  In that case *i is its new
+ *    class.
+ ******
+ */
+
+boolean
+grow_item(struct array *array, unsigned int *i, void *item, uintptr_t n)
+{
+    unsigned int j = *i;
+    boolean lr_bit = item_get_lr_bit(item);
+    boolean inh_bit = item_get_inh_bit(item);
+    void *buddy;
+
+    while (class_sizes[j] < n)
+    {
+        if (lr_bit != LEFT || j + FIB_K >= CLASS_COUNT)
+        {
+            return 0;
+        }
+        buddy = ((char*)item) + class_sizes[j] * BLOCK_SIZE;
+        if (item_is_in_use(buddy)
+            || item_get_size(buddy) != class_sizes[j+FIB_K-1])
+        {
+            return 0;
+        }
+        lr_bit = inh_bit;
+        inh_bit = item_get_inh_bit(buddy);
+        j += FIB_K;
+    }
+
+    j = *i;
+    while (class_sizes[j] < n)
+    {
+        buddy = ((char*)item) + class_sizes[j] * BLOCK_SIZE;
+        delete_item(array, j + FIB_K - 1, buddy);
+        array->merges++;
+        j += FIB_K;
+    }
+    item_set_size(item, class_sizes[j]);
+    item_set_lr_bit(item, lr_bit);
+    item_set_inh_bit(item, inh_bit);
+    *i = j;
+    return 1;
+}
+
+
+/****f* mem/realloc_in_place
+ *  NAME
+ *    realloc_in_place - try to resize an item without moving it
+ *  SYNOPSIS
+ *    boolean realloc_in_place(struct mem_heap *heap, void *item, size_t x)
+ *  DESCRIPTION
+ *    If the item is too small for x bytes, it tries to absorb its free
+ *    right buddies with grow_item.  Then, if it is bigger than needed, it
+ *    gives back its right parts with shrink_item.  The realloc counters of
+ *    the heap are updated, a failure counts as a move, because the caller
+ *    will have to copy the area.
+ *
+ *    A size of DIRECT_MIN_BYTES or more needs a direct area.  A direct
+ *    area is kept when x fits in it and takes at least half of it, so
+ *    that a shrunk area does not hold a mapping much bigger than itself.
+ *  RETURN VALUE
+ *    Whether the item now holds x bytes.
+ ******
+ */
+
+boolean
+realloc_in_place(struct mem_heap *heap, void *item, size_t x)
+{
+    struct array *array = &heap->array;
+    unsigned int i, j, k;
+    uintptr_t n;
+    size_t bytes;
+    heap->realloc_calls++;
+    x = harden_bytes(x);
+    if (item_is_direct(item))
+    {
+        bytes = item_get_bytes(item);
+        if (x >= DIRECT_MIN_BYTES && x <= bytes && x >= bytes / 2)
+        {
+            return 1;
+        }
+        heap->realloc_moved++;
+        return 0;
+    }
+    if (x >= DIRECT_MIN_BYTES)
+    {
+        heap->realloc_moved++;
+        return 0;
+    }
+    n = BLOCKS(x + HEADER_SIZE);
+    i = class_index(item_get_size(item));
+    j = i;
+    if (class_sizes[j] < n)
+    {
+        if (!grow_item(array, &j, item, n))
+        {
+            heap->realloc_moved++;
+            return 0;
+        }
+        heap->realloc_grown++;
+    }
+    k = shrink_item(array, j, item, n);
+    if (k != j)
+    {
+        heap->realloc_shrunk++;
+    }
+    array->data[i].used_count--;
+    array->data[k].used_count++;
+    return 1;
+}
+
+
+#if MEM_ALLOC_SLABS
+
+static inline uintptr_t
+slab_hash(struct slab *slab, uintptr_t mask)
+{
+    return ((uintptr_t)slab / SLAB_SIZE) * (uintptr_t)0x9e3779b97f4a7c15ull
+        & mask;
+}
+
+
+/****f* mem/slab_of
+ *  NAME
+ *    slab_of - find the slab containing an area
+ *  SYNOPSIS
+ *    struct slab *slab_of(struct mem_heap *heap, void *area)
+ *  DESCRIPTION
+ *    Looks up the address of the area rounded down to SLAB_SIZE in the set
+ *    of the slabs of the heap.  The pages of the slabs belong to their
+ *    region, so the area of an item is never in one of them.
+ *  RETURN VALUE
+ *    The slab, or NULL if the area is the area of an item.
+ ******
+ */
+
+static inline struct slab*
+slab_of(struct mem_heap *heap, void *area)
+{
+    struct slab_set *set = &heap->slab_set;
+    struct slab *slab;
+    uintptr_t i;
+    if (set->count == 0)
+    {
+        return NULL;
+    }
+    slab = (struct slab*)((uintptr_t)area & ~(uintptr_t)(SLAB_SIZE - 1));
+    for (i = slab_hash(slab, set->mask); set->keys[i] != NULL;
+        i = (i + 1) & set->mask)
+    {
+        if (set->keys[i] == slab)
+        {
+            return slab;
+        }
+    }
+    return NULL;
+}
+
+
+static void
+slab_set_add(struct slab_set *set, struct slab *slab)
+{
+    uintptr_t i = slab_hash(slab, set->mask);
+    while (set->keys[i] != NULL)
+    {
+        i = (i + 1) & set->mask;
+    }
+    set->keys[i] = slab;
+    set->count++;
+}
+
+
+/****f* mem/slab_set_remove
+ *  NAME
+ *    slab_set_remove - remove a slab from the set of a heap
+ *  SYNOPSIS
+ *    void slab_set_remove(struct slab_set *set, struct slab *slab)
+ *  DESCRIPTION
+ *    Empties the entry of the slab, then moves back into the hole the
+ *    following keys which would not be found after it, so that no entry
+ *    needs to be marked as deleted.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+slab_set_remove(struct slab_set *set, struct slab *slab)
+{
+    uintptr_t i, j, k;
+    i = slab_hash(slab, set->mask);
+    while (set->keys[i] != slab)
+    {
+        i = (i + 1) & set->mask;
+    }
+    for (j = (i + 1) & set->mask; set->keys[j] != NULL;
+        j = (j + 1) & set->mask)
+    {
+        k = slab_hash(set->keys[j], set->mask);
+        if (((j - k) & set->mask) >= ((j - i) & set->mask))
+        {
+            set->keys[i] = set->keys[j];
+            i = j;
+        }
+    }
+    set->keys[i] = NULL;
+    set->count--;
+}
+
+
+/****f* mem/slab_set_grow
+ *  NAME
+ *    slab_set_grow - double the capacity of the set of the slabs
+ *  SYNOPSIS
+ *    boolean slab_set_grow(struct mem_heap *heap)
+ *  DESCRIPTION
+ *    The keys are moved to a new item of the heap twice as big, or of
+ *    SLAB_SET_MIN entries for the first slabs, and the old item is freed.
+ *  RETURN VALUE
+ *    0 if the heap cannot grow, and the set is unchanged, otherwise 1.
+ ******
+ */
+
+boolean
+slab_set_grow(struct mem_heap *heap)
+{
+    struct slab_set *set = &heap->slab_set;
+    struct slab **old = set->keys;
+    uintptr_t old_size = old != NULL ? set->mask + 1 : 0;
+    uintptr_t size = old != NULL ? 2 * old_size : SLAB_SET_MIN;
+    uintptr_t i;
+    void *item = alloc_item(heap,
+        BLOCKS(size * sizeof(struct slab*) + HEADER_SIZE));
+    if (item == NULL)
+    {
+        return 0;
+    }
+    set->keys = item_get_area(item);
+    memset(set->keys, 0, size * sizeof(struct slab*));
+    set->mask = size - 1;
+    set->count = 0;
+    for (i = 0; i < old_size; i++)
+    {
+        if (old[i] != NULL)
+        {
+            slab_set_add(set, old[i]);
+        }
+    }
+    if (old != NULL)
+    {
+        free_item(heap, item_from_area(old));
+    }
+    return 1;
+}
+
+
+static inline void
+slab_push(struct slab **list, struct slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL)
+    {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+
+static inline void
+slab_unlink(struct slab **list, struct slab *slab)
+{
+    if (slab->prev != NULL)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *list = slab->next;
+    }
+    if (slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+}
+
+
+/****f* mem/slab_add_region
+ *  NAME
+ *    slab_add_region - carve new empty slabs from the heap
+ *  SYNOPSIS
+ *    boolean slab_add_region(struct mem_heap *heap)
+ *  DESCRIPTION
+ *    Allocates an item of SLAB_REGION slabs, cuts all the slabs aligned on
+ *    SLAB_SIZE its area holds, and adds them to the set and to the empty
+ *    slabs of the heap.  The area is not aligned itself, because the
+ *    aligned items are rare in the free items, and a region given back to
+ *    the heap would often be allocated again from a new chunk.
+ *  RETURN VALUE
+ *    0 if the heap cannot grow, otherwise 1.
+ ******
+ */
+
+boolean
+slab_add_region(struct mem_heap *heap)
+{
+    struct slab_set *set = &heap->slab_set;
+    struct slab *region, *slab;
+    void *item;
+    unsigned int k, count;
+    item = alloc_item(heap, BLOCKS(SLAB_REGION * SLAB_SIZE + HEADER_SIZE));
+    if (item == NULL)
+    {
+        return 0;
+    }
+    region = (struct slab*)(((uintptr_t)item_get_area(item) + SLAB_SIZE - 1)
+        & ~(uintptr_t)(SLAB_SIZE - 1));
+    count = (unsigned int)(((char*)item + item_get_size(item) * BLOCK_SIZE
+            - (char*)region) / SLAB_SIZE);
+    debug("slab region at %p, %u slabs\n", (void*)region, count);
+    while ((set->count + count) * 2 > set->mask + 1)
+    {
+        if (!slab_set_grow(heap))
+        {
+            free_item(heap, item);
+            return 0;
+        }
+    }
+    for (k = 0; k < count; k++)
+    {
+        slab = (struct slab*)((char*)region + (size_t)k * SLAB_SIZE);
+        slab->region = region;
+        slab->size = 0;
+        slab_set_add(set, slab);
+        slab_push(&heap->slab_empty, slab);
+    }
+    region->item = item;
+    region->count = count;
+    region->empty = count;
+    heap->slab_count += count;
+    heap->slab_empty_count += count;
+    return 1;
+}
+
+
+/****f* mem/slab_release_region
+ *  NAME
+ *    slab_release_region - give a region of empty slabs back to the heap
+ *  SYNOPSIS
+ *    void slab_release_region(struct mem_heap *heap, struct slab *region)
+ *  DESCRIPTION
+ *    Every slab of the region must be empty.  They are removed from the
+ *    empty slabs and from the set, and the item of the region is freed.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+slab_release_region(struct mem_heap *heap, struct slab *region)
+{
+    unsigned int k, count = region->count;
+    struct slab *slab;
+    debug("release slab region %p\n", (void*)region);
+    for (k = 0; k < count; k++)
+    {
+        slab = (struct slab*)((char*)region + (size_t)k * SLAB_SIZE);
+        slab_unlink(&heap->slab_empty, slab);
+        slab_set_remove(&heap->slab_set, slab);
+    }
+    heap->slab_count -= count;
+    heap->slab_empty_count -= count;
+    free_item(heap, region->item);
+}
+
+
+/* releases every region whose slabs are all empty */
+void
+slab_trim(struct mem_heap *heap)
+{
+    struct slab *slab = heap->slab_empty;
+    while (slab != NULL)
+    {
+        if (slab->region->empty == slab->region->count)
+        {
+            slab_release_region(heap, slab->region);
+            slab = heap->slab_empty;        // the list has changed
+        }
+        else
+        {
+            slab = slab->next;
+        }
+    }
+}
+
+
+/****f* mem/slab_alloc
+ *  NAME
+ *    slab_alloc - allocate a slot from the slabs of a heap
+ *  SYNOPSIS
+ *    void *slab_alloc(struct mem_heap *heap, size_t x)
+ *  DESCRIPTION
+ *    Takes a slot of the class of x bytes, at most SLAB_MAX_BYTES, from
+ *    the first slab of the list of the class.  When the list is empty, an
+ *    empty slab is given the class, and a new region is carved when there
+ *    is no empty slab.  A slab which becomes full leaves the list.  The
+ *    allocation is counted.
+ *  RETURN VALUE
+ *    The slot, or NULL if the heap cannot grow.
+ ******
+ */
+
+void*
+slab_alloc(struct mem_heap *heap, size_t x)
+{
+    unsigned int c = (unsigned int)SLAB_CLASS(x);
+    struct slab *slab = heap->slabs[c];
+    void *slot;
+    if (slab == NULL)
+    {
+        if (heap->slab_empty == NULL && !slab_add_region(heap))
+        {
+            return NULL;
+        }
+        slab = heap->slab_empty;
+        slab_unlink(&heap->slab_empty, slab);
+        heap->slab_empty_count--;
+        slab->region->empty--;
+        slab->size = (c + 1) * BLOCK_SIZE;
+        slab->used = 0;
+        slab->free = NULL;
+        slab->top = (char*)slab + SLAB_HEADER;
+        slab_push(&heap->slabs[c], slab);
+    }
+    if (slab->free != NULL)
+    {
+        slot = slab->free;
+        slab->free = *(void**)slot;
+    }
+    else
+    {
+        slot = slab->top;
+        slab->top += slab->size;
+    }
+    slab->used++;
+    if (slab->free == NULL && slab->top + slab->size > (char*)slab + SLAB_SIZE)
+    {
+        slab_unlink(&heap->slabs[c], slab);     // full
+    }
+    heap->slot_count++;
+    count_bytes(&heap->counters, x, slab->size);
+    return slot;
+}
+
+
+/****f* mem/slab_free
+ *  NAME
+ *    slab_free - put a slot back into its slab
+ *  SYNOPSIS
+ *    void slab_free(struct mem_heap *heap, struct slab *slab, void *area)
+ *  DESCRIPTION
+ *    The slot goes to the free list of its slab, and a slab which was full
+ *    goes back to the list of its class.  A slab which becomes empty goes
+ *    to the empty slabs.  When all the slabs of its region are empty, the
+ *    region is given back to the heap, unless the other empty slabs are
+ *    fewer than SLAB_REGION, so that a heap which keeps allocating and
+ *    freeing a few slots does not carve a region each time.
+ *  RETURN VALUE
+ *    Does not return anything.
+ ******
+ */
+
+void
+slab_free(struct mem_heap *heap, struct slab *slab, void *area)
+{
+    struct slab **list = &heap->slabs[SLAB_CLASS(slab->size)];
+    struct slab *region = slab->region;
+    if (slab->free == NULL && slab->top + slab->size > (char*)slab + SLAB_SIZE)
+    {
+        slab_push(list, slab);                  // was full
+    }
+    *(void**)area = slab->free;
+    slab->free = area;
+    slab->used--;
+    heap->slot_count--;
+    if (slab->used == 0)
+    {
+        slab_unlink(list, slab);
+        slab->size = 0;
+        slab_push(&heap->slab_empty, slab);
+        heap->slab_empty_count++;
+        region->empty++;
+        if (region->empty == region->count
+            && heap->slab_empty_count >= region->count + SLAB_REGION)
+        {
+            slab_release_region(heap, region);
+        }
+    }
+}
+
+
+/****f* mem/slab_realloc
+ *  NAME
+ *    slab_realloc - change the size of a slot
+ *  SYNOPSIS
+ *    void *slab_realloc(struct mem_heap *heap, struct slab *slab,
+ *        void *area, size_t x)
+ *  DESCRIPTION
+ *    The slot is kept when x bytes fit into it, otherwise a slot of a
+ *    bigger class or an item is allocated, the contents copied and the
+ *    slot freed.  The call is counted and recorded in the trace.
+ *  RETURN VALUE
+ *    The area, which can have moved, or NULL if the heap cannot grow, and
+ *    the slot is unchanged.
+ ******
+ */
+
+void*
+slab_realloc(struct mem_heap *heap, struct slab *slab, void *area,
+    size_t x)
+{
+    void *item, *new_area;
+    heap->realloc_calls++;
+    if (x <= slab->size)
+    {
+        count_bytes(&heap->counters, x, slab->size);
+        trace_slot(MEM_TRACE_REALLOC, x, area, slab->size, area);
+        return area;
+    }
+    heap->realloc_moved++;
+    if (x <= SLAB_MAX_BYTES)
+    {
+        new_area = slab_alloc(heap, x);
+        if (new_area == NULL)
+        {
+            return NULL;
+        }
+        trace_slot(MEM_TRACE_REALLOC, x, new_area, SLAB_SLOT_BYTES(x), area);
+    }
+    else
+    {
+        item = heap_alloc_item(heap, x);
+        if (item == NULL)
+        {
+            return NULL;
+        }
+        count_alloc(&heap->counters, x, item);
+        trace(MEM_TRACE_REALLOC, x, item, area);
+        new_area = item_get_area(item);
+    }
+    memcpy(new_area, area, slab->size);
+    slab_free(heap, slab, area);
+    return new_area;
+}
+
+#endif /* MEM_ALLOC_SLABS */
+
+
+/****f* mem/mem_heap_create
+ *  NAME
+ *    mem_heap_create - create a new independent heap
+ *  SYNOPSIS
+ *    struct mem_heap *mem_heap_create()
+ *  DESCRIPTION
+ *    Initializes a heap on the stack, then allocates the structure of the
+ *    heap from the heap itself, aligned on a cache line, and moves it
+ *    there.  In the thread-safe mode the heap is added to heap_list.
+ *  RETURN VALUE
+ *    The new heap, or NULL if the OS has no more memory.
+ ******
+ */
+
+struct mem_heap*
+mem_heap_create()
+{
+    struct mem_heap tmp, *heap;
+    void *item;
+    heap_init(&tmp);
+    item = alloc_aligned_item(&tmp,
+        BLOCKS(sizeof(struct mem_heap) + HEADER_SIZE), CACHE_LINE);
+    if (item == NULL)
+    {
+        index_move_heap(&tmp, NULL);
+        chunks_free(tmp.mem_list);
+        return NULL;
+    }
+    heap = item_get_area(item);
+    *heap = tmp;
+    index_move_heap(&tmp, heap);
+    HEAP_LOCK_INIT(heap);
+#if MEM_ALLOC_THREADS
+    pthread_mutex_lock(&heap_list_lock);
+    heap->next_heap = heap_list;
+    heap_list = heap;
+    pthread_mutex_unlock(&heap_list_lock);
+#endif
+    debug("heap created at %p\n", (void*)heap);
+    return heap;
+}
+
+
+/****f* mem/mem_heap_destroy
+ *  NAME
+ *    mem_heap_destroy - return all the memory of a heap to the OS
+ *  SYNOPSIS
+ *    void mem_heap_destroy(struct mem_heap *heap)
+ *  DESCRIPTION
+ *    All the chunks of the heap are returned to the OS, including the one
+ *    containing the heap structure and those of the direct areas.  The
+ *    areas allocated from the heap do not need to be freed before.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+mem_heap_destroy(struct mem_heap *heap)
+{
+#if MEM_ALLOC_THREADS
+    struct mem_heap **link;
+#endif
+    debug("destroying heap %p\n", (void*)heap);
+#if MEM_ALLOC_THREADS
+    pthread_mutex_lock(&heap_list_lock);
+    for (link = &heap_list; *link != heap; link = &(*link)->next_heap)
+        ;
+    *link = heap->next_heap;
+    pthread_mutex_unlock(&heap_list_lock);
+#endif
+    HEAP_LOCK_DESTROY(heap);
+    index_move_heap(heap, NULL);
+    chunks_free(heap->direct_list);
+    chunks_free(heap->mem_list);
+}
+
+
+/****f* mem/mem_heap_alloc
+ *  NAME
+ *    mem_heap_alloc - allocate an area block of a minumum number of bytes
+ *        from a heap
+ *  SYNOPSIS
+ *    void *mem_heap_alloc(struct mem_heap *heap, size_t x)
+ *  DESCRIPTION
+ *    Allocates minimum x bytes.  Up to SLAB_MAX_BYTES, the area is a slot
+ *    of a slab, see slab_alloc.  From DIRECT_MIN_BYTES, it is a direct
+ *    area, see direct_alloc.  Otherwise the number of blocks needed,
+ *    header included, is computed and an item of at least this size is
+ *    allocated by alloc_item.
+ *  RETURN VALUE
+ *    An area of minimum x bytes, or NULL if x is too big or the OS has no
+ *    more memory.
+ ******
+ */
+
+void*
+mem_heap_alloc(struct mem_heap *heap, size_t x)
+{
+    void *item, *area;
+#if MEM_ALLOC_SLABS
+    if (x <= SLAB_MAX_BYTES && heap_has_slabs(heap))
+    {
+        HEAP_LOCK(heap);
+        area = slab_alloc(heap, x);
+        HEAP_UNLOCK(heap);
+        if (area == NULL)
+        {
+            return NULL;
+        }
+        trace_slot(MEM_TRACE_ALLOC, x, area, SLAB_SLOT_BYTES(x), NULL);
+        debug("allocated %lu bytes at %p in a slab\n", (unsigned long)x,
+            area);
+        return area;
+    }
+#endif
+    debug("mem_alloc: %lu bytes\n", (unsigned long)x);
+
+    HEAP_LOCK(heap);
+    item = heap_alloc_item(heap, x);
+    if (item == NULL)
+    {
+        HEAP_UNLOCK(heap);
+        return NULL;
+    }
+    count_alloc(&heap->counters, x, item);
+    HEAP_UNLOCK(heap);
+    harden_alloc(item, 0, x);
+    trace(MEM_TRACE_ALLOC, x, item, NULL);
+
+    area = item_get_area(item);
+    debug("allocated %lu bytes at %p\n", (unsigned long)x, area);
+    return area;
+}
+
+
+/****f* mem/mem_heap_alloc_aligned
+ *  NAME
+ *    mem_heap_alloc_aligned - allocate an aligned area from a heap
+ *  SYNOPSIS
+ *    void *mem_heap_alloc_aligned(struct mem_heap *heap, size_t alignment,
+ *        size_t x)
+ *  DESCRIPTION
+ *    Allocates minimum x bytes at an address which is a multiple of
+ *    alignment, a power of 2.  Every area is aligned on a word, otherwise
+ *    the item is chosen by alloc_aligned_item among the items the free
+ *    items can be split into.  When x or alignment is DIRECT_MIN_BYTES or
+ *    more, the area is a direct area placed in its chunk at the alignment.
+ *    The area is freed by mem_heap_free, but mem_heap_realloc does not
+ *    keep the alignment if it moves it.
+ *  RETURN VALUE
+ *    An area of minimum x bytes, or NULL if alignment is not a power of 2,
+ *    if x is too big or if the OS has no more memory.
+ ******
+ */
+
+void*
+mem_heap_alloc_aligned(struct mem_heap *heap, size_t alignment,
+    size_t x)
+{
+    void *item;
+    size_t bytes;
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        return NULL;
+    }
+    if (alignment <= HEADER_SIZE)
+    {
+        return mem_heap_alloc(heap, x);
+    }
+    debug("mem_alloc_aligned: %lu bytes, alignment %lu\n", (unsigned long)x,
+        (unsigned long)alignment);
+
+    HEAP_LOCK(heap);
+    bytes = harden_bytes(x);
+    if (bytes >= DIRECT_MIN_BYTES || alignment >= DIRECT_MIN_BYTES)
+    {
+        item = direct_alloc(heap, bytes, alignment);
+    }
+    else
+    {
+        item = alloc_aligned_item(heap, BLOCKS(bytes + HEADER_SIZE),
+            alignment);
+    }
+    if (item == NULL)
+    {
+        HEAP_UNLOCK(heap);
+        return NULL;
+    }
+    count_alloc(&heap->counters, x, item);
+    HEAP_UNLOCK(heap);
+    harden_alloc(item, 0, x);
+    trace(MEM_TRACE_ALLOC, x, item, NULL);
+    return item_get_area(item);
+}
+
+
+/****f* mem/mem_heap_free
+ *  NAME
+ *    mem_heap_free - put the item back into the free list of a heap
+ *  SYNOPSIS
+ *    void mem_heap_free(struct mem_heap *heap, void *area)
+ *  DESCRIPTION
+ *    Return the item after use to the free list.  A slot of a slab goes
+ *    back to its slab.  Otherwise the first thing is to get the item
+ *    pointer from the address from the area, then it is freed by
+ *    free_item.  The area must have been allocated from the same heap.
+ *    In the thread-safe mode an area of the default heap goes through
+ *    mem_free, so that the small items go to the cache of the thread,
+ *    such as with mem_heap_free(mem_heap_of(p), p).
+ *  RETURN VALUE
+ *    Does not return anything.
+ ******
+ */
+
+void
+mem_heap_free(struct mem_heap *heap, void *area)
+{
+#if MEM_ALLOC_SLABS
+    struct slab *slab;
+#endif
+#if MEM_ALLOC_THREADS
+    if (heap == &default_heap)
+    {
+        mem_free(area);
+        return;
+    }
+#endif
+    debug("freeing %p\n", area);
+
+    HEAP_LOCK(heap);
+#if MEM_ALLOC_SLABS
+    slab = slab_of(heap, area);
+    if (slab != NULL)
+    {
+        trace_slot(MEM_TRACE_FREE, 0, area, slab->size, NULL);
+        slab_free(heap, slab, area);
+        HEAP_UNLOCK(heap);
+        return;
+    }
+#endif
+    trace(MEM_TRACE_FREE, 0, item_from_area(area), NULL);
+    harden_free(heap, item_from_area(area));
+    free_item(heap, item_from_area(area));
+    HEAP_UNLOCK(heap);
+}
+
+
+#if MEM_ALLOC_DEBUG || MEM_ALLOC_HARDEN
+
+/* aborts when an item is freed with a size x whose class is above the
+ * class of the item, or bigger than its direct area
+ */
+static void
+check_free_class(void *item, size_t x)
+{
+    unsigned int c;
+    c = class_index(BLOCKS(harden_bytes(x) + HEADER_SIZE));
+    if (item_is_direct(item) ? harden_bytes(x) > item_get_bytes(item)
+        : c > class_index(item_get_size(item)))
+    {
+        fprintf(stderr, "mem: free of %lu bytes at %p, which has %lu bytes\n",
+            (unsigned long)x, item_get_area(item),
+            (unsigned long)item_get_bytes(item));
+        abort();
+    }
+}
+
+#else
+#define check_free_class(item, x) ((void)0)
+#endif
+
+
+/****f* mem/mem_heap_free_sized
+ *  NAME
+ *    mem_heap_free_sized - free an area of a heap whose size is known
+ *  SYNOPSIS
+ *    void mem_heap_free_sized(struct mem_heap *heap, void *area, size_t x)
+ *  DESCRIPTION
+ *    The same as mem_heap_free, for an area of at least x bytes, such as
+ *    the size asked when it was allocated or reallocated.  A slot holds
+ *    at most SLAB_MAX_BYTES, so a bigger x tells that the area is an item
+ *    without looking for a slab.  Otherwise x is only a hint: the class
+ *    of the item is read from its header, which free_item updates anyway,
+ *    because an item can be above the class of x: the first classes are
+ *    not split, and an aligned or reallocated item can keep a bigger
+ *    class.  Debug and hardened builds compute the class of x and abort
+ *    if it is above the class of the item.
+ *  RETURN VALUE
+ *    Does not return anything.
+ ******
+ */
+
+void
+mem_heap_free_sized(struct mem_heap *heap, void *area, size_t x)
+{
+#if MEM_ALLOC_THREADS
+    if (heap == &default_heap)
+    {
+        mem_free_sized(area, x);
+        return;
+    }
+#endif
+#if MEM_ALLOC_SLABS
+    if (x <= SLAB_MAX_BYTES)
+    {
+        mem_heap_free(heap, area);      // a slot, or a small item
+        return;
+    }
+#endif
+    debug("freeing %p, %lu bytes\n", area, (unsigned long)x);
+    HEAP_LOCK(heap);
+    trace(MEM_TRACE_FREE, 0, item_from_area(area), NULL);
+    harden_free(heap, item_from_area(area));   // checks the item first
+    check_free_class(item_from_area(area), x);
+    free_item(heap, item_from_area(area));
+    HEAP_UNLOCK(heap);
+}
+
+
+/****f* mem/mem_heap_alloc_batch
+ *  NAME
+ *    mem_heap_alloc_batch - allocate many areas of the same size
+ *  SYNOPSIS
+ *    unsigned int mem_heap_alloc_batch(struct mem_heap *heap, size_t x,
+ *        unsigned int count, void **areas)
+ *  DESCRIPTION
+ *    Fills areas with count areas of minimum x bytes, taking the lock of
+ *    the heap once.  The slots come from slab_alloc, and the items from
+ *    alloc_items, which splits one big item into many in a single pass
+ *    instead of searching the classes and splitting for each.  The direct
+ *    areas are allocated one by one.  Each area is freed by mem_heap_free,
+ *    or all at once by mem_heap_free_batch.
+ *  RETURN VALUE
+ *    The number of areas allocated, the first ones of areas, less than
+ *    count only if x is too big or the OS has no more memory.
+ ******
+ */
+
+unsigned int
+mem_heap_alloc_batch(struct mem_heap *heap, size_t x, unsigned int count,
+    void **areas)
+{
+    unsigned int k, done;
+    size_t bytes;
+    debug("mem_alloc_batch: %u areas of %lu bytes\n", count,
+        (unsigned long)x);
+    HEAP_LOCK(heap);
+#if MEM_ALLOC_SLABS
+    if (x <= SLAB_MAX_BYTES && heap_has_slabs(heap))
+    {
+        for (k = 0; k < count; k++)
+        {
+            areas[k] = slab_alloc(heap, x);
+            if (areas[k] == NULL)
+            {
+                break;
+            }
+            trace_slot(MEM_TRACE_ALLOC, x, areas[k], SLAB_SLOT_BYTES(x),
+                NULL);
+        }
+        HEAP_UNLOCK(heap);
+        return k;
+    }
+#endif
+    bytes = harden_bytes(x);
+    if (bytes >= DIRECT_MIN_BYTES)
+    {
+        for (done = 0; done < count; done++)
+        {
+            areas[done] = direct_alloc(heap, bytes, 0);
+            if (areas[done] == NULL)
+            {
+                break;
+            }
+        }
+    }
+    else
+    {
+        done = alloc_items(heap, BLOCKS(bytes + HEADER_SIZE), count, areas);
+    }
+    for (k = 0; k < done; k++)
+    {
+        count_alloc(&heap->counters, x, areas[k]);
+        harden_alloc(areas[k], 0, x);
+        trace(MEM_TRACE_ALLOC, x, areas[k], NULL);
+        areas[k] = item_get_area(areas[k]);
+    }
+    HEAP_UNLOCK(heap);
+    return done;
+}
+
+
+/* sorts the areas by address, by an LSD radix sort of 8 bits per pass on
+ * the offsets from the lowest address, buffer holding count areas, as the
+ * comparisons of qsort cost more than the sort saves in free_item
+ */
+static void
+sort_areas(void **areas, unsigned int count, void **buffer)
+{
+    void **src = areas, **dst = buffer, **tmp;
+    unsigned int counts[256];
+    unsigned int i, sum, shift;
+    uintptr_t low = UINTPTR_MAX, high = 0, x;
+    for (i = 0; i < count; i++)
+    {
+        x = (uintptr_t)areas[i];
+        low = x < low ? x : low;
+        high = x > high ? x : high;
+    }
+    for (shift = 3; shift < 8 * sizeof(uintptr_t)
+        && ((high - low) >> shift) != 0; shift += 8)
+    {
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < count; i++)
+        {
+            counts[(((uintptr_t)src[i] - low) >> shift) & 255]++;
+        }
+        for (i = 0, sum = 0; i < 256; i++)
+        {
+            sum += counts[i];
+            counts[i] = sum - counts[i];
+        }
+        for (i = 0; i < count; i++)
+        {
+            dst[counts[(((uintptr_t)src[i] - low) >> shift) & 255]++] = src[i];
+        }
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != areas)
+    {
+        memcpy(areas, src, count * sizeof(areas[0]));
+    }
+}
+
+
+/* inserts the items of a run into the free lists by merge_item, the items
+ * being in use and not counted as used anymore
+ */
+static void
+run_flush(struct mem_heap *heap, void **run, unsigned int *classes,
+    unsigned int count)
+{
+    while (count > 0)
+    {
+        count--;
+        merge_item(heap, run[count], classes[count]);
+    }
+}
+
+
+/* adds an item, not counted as used anymore, to the run of adjacent items
+ * being freed, which is flushed first if the item does not follow it, and
+ * merges the top of the run while it is a left buddy followed by its
+ * right buddy: the parent replaces them without going through the free
+ * lists.  Returns the new count of the run.
+ */
+static unsigned int
+run_push(struct mem_heap *heap, void **run, unsigned int *classes,
+    unsigned int count, void *item, unsigned int i)
+{
+    void *left, *right;
+    if (count > 0 && (count == RUN_MAX || (char*)item != (char*)run[count - 1]
+        + item_get_size(run[count - 1]) * BLOCK_SIZE))
+    {
+        run_flush(heap, run, classes, count);
+        count = 0;
+    }
+    run[count] = item;
+    classes[count] = i;
+    count++;
+    while (count > 1 && item_get_lr_bit(run[count - 2]) == LEFT
+        && classes[count - 1] == classes[count - 2] + FIB_K - 1)
+    {
+        left = run[count - 2];
+        right = run[count - 1];
+        count--;
+        classes[count - 1] += FIB_K;
+        heap->array.merges++;
+        item_set_lr_bit(left, item_get_inh_bit(left));
+        item_set_inh_bit(left, item_get_inh_bit(right));
+        item_set_size(left, class_sizes[classes[count - 1]]);
+    }
+    return count;
+}
+
+
+/* frees the areas of mem_heap_free_batch, without the cache of the thread */
+static void
+free_batch(struct mem_heap *heap, void **areas, unsigned int count)
+{
+    void *stack[SORT_STACK];
+    void **buffer = NULL;
+    void *run[RUN_MAX], *item;
+    unsigned int classes[RUN_MAX];
+    unsigned int k, i, run_count = 0;
+#if MEM_ALLOC_SLABS
+    struct slab *slab;
+#endif
+    debug("mem_free_batch: %u areas\n", count);
+    for (k = 1; k < count && areas[k - 1] <= areas[k]; k++)
+        ;
+    if (k < count)
+    {
+        buffer = count <= SORT_STACK ? stack
+            : mem_heap_alloc(heap, count * sizeof(void*));
+        if (buffer != NULL)
+        {
+            sort_areas(areas, count, buffer);
+        }
+    }
+    HEAP_LOCK(heap);
+    for (k = 0; k < count; k++)
+    {
+#if MEM_ALLOC_SLABS
+        slab = slab_of(heap, areas[k]);
+        if (slab != NULL)
+        {
+            trace_slot(MEM_TRACE_FREE, 0, areas[k], slab->size, NULL);
+            slab_free(heap, slab, areas[k]);
+            continue;
+        }
+#endif
+        item = item_from_area(areas[k]);
+        trace(MEM_TRACE_FREE, 0, item, NULL);
+        harden_free(heap, item);
+        if (item_is_direct(item) || heap->lazy_max > 0)
+        {
+            free_item(heap, item);
+            continue;
+        }
+        i = class_index(item_get_size(item));
+        heap->array.data[i].used_count--;
+        run_count = run_push(heap, run, classes, run_count, item, i);
+    }
+    run_flush(heap, run, classes, run_count);
+    HEAP_UNLOCK(heap);
+    if (buffer != NULL && buffer != stack)
+    {
+        mem_heap_free(heap, buffer);
+    }
+}
+
+
+/****f* mem/mem_heap_free_batch
+ *  NAME
+ *    mem_heap_free_batch - free many areas of a heap
+ *  SYNOPSIS
+ *    void mem_heap_free_batch(struct mem_heap *heap, void **areas,
+ *        unsigned int count)
+ *  DESCRIPTION
+ *    Frees the count areas, taking the lock of the heap once.  The array
+ *    is sorted by address in place first, unless it already is, so that
+ *    the headers are visited in the order of the memory.  Above
+ *    SORT_STACK areas the buffer of the sort is allocated from the heap,
+ *    and the areas are freed in their order if it cannot be.  The items
+ *    which follow each other form a run, in which a left buddy followed by
+ *    its right buddy is merged at once into their parent, by run_push,
+ *    without going through the free lists.  Each item left in the run is
+ *    then inserted and merged with its free buddies by merge_item.  In the
+ *    lazy mode the items go to the unmerged lists
+ *    as with free_item.  In the
+ *    thread-safe mode the areas of the default heap go through
+ *    mem_free_batch, which puts the small items into the cache.
+ *  RETURN VALUE
+ *    Does not return anything.
+ ******
+ */
+
+void
+mem_heap_free_batch(struct mem_heap *heap, void **areas, unsigned int count)
+{
+#if MEM_ALLOC_THREADS
+    if (heap == &default_heap)
+    {
+        mem_free_batch(areas, count);
+        return;
+    }
+#endif
+    free_batch(heap, areas, count);
+}
+
+
+/****f* mem/mem_heap_realloc
+ *  NAME
+ *    mem_heap_realloc - change the size of an area of a heap
+ *  SYNOPSIS
+ *    void *mem_heap_realloc(struct mem_heap *heap, void *area, size_t x)
+ *  DESCRIPTION
+ *    Resizes the area to minimum x bytes, keeping its contents.  The item
+ *    is grown or shrunk in place by realloc_in_place when possible, and
+ *    only otherwise a new area is allocated, the contents copied and the
+ *    old area freed.  A slot of a slab is resized by slab_realloc.  A NULL
+ *    area is allocated.
+ *  RETURN VALUE
+ *    The area, which can have moved, or NULL if x is too big or the OS has
+ *    no more memory, and the area is left as it was.
+ ******
+ */
+
+void*
+mem_heap_realloc(struct mem_heap *heap, void *area, size_t x)
+{
+    void *item, *new_item;
+    size_t old_bytes;
+#if MEM_ALLOC_SLABS
+    struct slab *slab;
+#endif
+    if (area == NULL)
+    {
+        return mem_heap_alloc(heap, x);
+    }
+    debug("realloc %p to %lu bytes\n", area, (unsigned long)x);
+    HEAP_LOCK(heap);
+#if MEM_ALLOC_SLABS
+    slab = slab_of(heap, area);
+    if (slab != NULL)
+    {
+        area = slab_realloc(heap, slab, area, x);
+        HEAP_UNLOCK(heap);
+        return area;
+    }
+#endif
+    item = item_from_area(area);
+    old_bytes = checked_bytes(heap, item);
+    new_item = item;
+    if (!realloc_in_place(heap, item, x))
+    {
+        new_item = heap_alloc_item(heap, x);
+        if (new_item == NULL)
+        {
+            HEAP_UNLOCK(heap);
+            return NULL;
+        }
+        memcpy(item_get_area(new_item), area, old_bytes < x ? old_bytes : x);
+        harden_free(heap, item);
+        free_item(heap, item);
+    }
+    count_alloc(&heap->counters, x, new_item);
+    harden_alloc(new_item, old_bytes < x ? old_bytes : x, x);
+    HEAP_UNLOCK(heap);
+    trace(MEM_TRACE_REALLOC, x, new_item, area);
+    return item_get_area(new_item);
+}
+
+
+/****f* mem/mem_heap_usable_size
+ *  NAME
+ *    mem_heap_usable_size - the number of bytes usable in an area of a heap
+ *  SYNOPSIS
+ *    size_t mem_heap_usable_size(struct mem_heap *heap, void *area)
+ *  DESCRIPTION
+ *    The area can hold more bytes than asked, because its size was rounded
+ *    up to the size of a slot or to its class.
+ *  RETURN VALUE
+ *    The size of the slot or of the item of the area, without its header.
+ ******
+ */
+
+size_t
+mem_heap_usable_size(struct mem_heap *heap, void *area)
+{
+#if MEM_ALLOC_SLABS
+    struct slab *slab;
+    HEAP_LOCK(heap);
+    slab = slab_of(heap, area);
+    HEAP_UNLOCK(heap);
+    if (slab != NULL)
+    {
+        return slab->size;          // kept while the slot is in use
+    }
+#elif MEM_ALLOC_HARDEN
+    size_t x;
+    HEAP_LOCK(heap);
+    x = harden_check(heap, item_from_area(area));
+    HEAP_UNLOCK(heap);
+    return x;                       // the canary follows
+#else
+    (void)heap;
+#endif
+    return item_get_bytes(item_from_area(area));
+}
+
+
+/****f* mem/mem_heap_realloc_stats
+ *  NAME
+ *    mem_heap_realloc_stats - how often realloc did not move the area
+ *  SYNOPSIS
+ *    void mem_heap_realloc_stats(struct mem_heap *heap,
+ *        struct mem_realloc_stats *stats)
+ *  DESCRIPTION
+ *    Fills stats with the realloc counters of the heap.  A call which
+ *    grows an item and then gives back its extra part counts both as grown
+ *    and as shrunk, so in_place is computed from calls and moved.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+mem_heap_realloc_stats(struct mem_heap *heap,
+    struct mem_realloc_stats *stats)
+{
+    HEAP_LOCK(heap);
+    stats->calls = heap->realloc_calls;
+    stats->in_place = heap->realloc_calls - heap->realloc_moved;
+    stats->grown = heap->realloc_grown;
+    stats->shrunk = heap->realloc_shrunk;
+    stats->moved = heap->realloc_moved;
+    HEAP_UNLOCK(heap);
+}
+
+
+/****f* mem/mem_heap_stats
+ *  NAME
+ *    mem_heap_stats - figures about the memory of a heap
+ *  SYNOPSIS
+ *    void mem_heap_stats(struct mem_heap *heap, struct mem_stats *stats)
+ *  DESCRIPTION
+ *    Fills stats from the counters kept by the heap and by its cells, so
+ *    it only walks the CLASS_COUNT cells of the array.  handed_out -
+ *    requested is the internal fragmentation: the rounding of sizes to
+ *    blocks and then to classes, plus the headers.  The free bytes spread
+ *    in many small items, compared to largest_free, give the external
+ *    fragmentation.
+ *
+ *    The used items include the structure of a heap of mem_heap_create,
+ *    and the regions of the slabs, whose slots in use are counted by
+ *    slots.  In the thread-safe mode the items kept by the caches of the
+ *    threads count as used, and the allocations served by a cache are
+ *    added to requested and handed_out at its next refill or flush.  The
+ *    unmerged items of the lazy mode count as free.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+mem_heap_stats(struct mem_heap *heap, struct mem_stats *stats)
+{
+    struct array *array = &heap->array;
+    struct mem_class_stats *cls;
+    unsigned int i;
+    HEAP_LOCK(heap);
+    stats->requested = heap->counters.requested;
+    stats->handed_out = heap->counters.handed_out;
+    stats->allocations = heap->counters.allocations;
+    stats->used_bytes = 0;
+    stats->free_bytes = 0;
+    stats->largest_free = 0;
+    stats->chunks = heap->chunk_count;
+    stats->chunk_bytes = heap->chunk_bytes;
+    stats->direct = heap->direct_count;
+    stats->direct_bytes = heap->direct_bytes;
+    stats->splits = array->splits;
+    stats->merges = array->merges;
+    stats->classes = CLASS_COUNT;
+#if MEM_ALLOC_SLABS
+    stats->slabs = heap->slab_count;
+    stats->slots = heap->slot_count;
+#else
+    stats->slabs = 0;
+    stats->slots = 0;
+#endif
+    for (i = 0; i < CLASS_COUNT; i++)
+    {
+        cls = &stats->cls[i];
+        cls->size = class_sizes[i] * BLOCK_SIZE;
+        cls->free = array->data[i].free_count + heap->unmerged_count[i];
+        cls->used = array->data[i].used_count;
+        stats->used_bytes += cls->used * cls->size;
+        stats->free_bytes += cls->free * cls->size;
+        if (cls->free > 0)
+        {
+            stats->largest_free = cls->size;
+        }
+    }
+    HEAP_UNLOCK(heap);
+}
+
+
+/* the items found by mem_heap_check in the chunks */
+struct check_counts {
+    unsigned long free_items[CLASS_COUNT];
+    unsigned long used_items[CLASS_COUNT];
+    size_t free_chunk_bytes;
+};
+
+
+/* prints the first inconsistency found by mem_heap_check */
+static boolean
+check_fail(void *item, const char *problem)
+{
+    fprintf(stderr, "mem_check: %s at %p\n", problem, item);
+    return 0;
+}
+
+
+/****f* mem/check_chunk
+ *  NAME
+ *    check_chunk - check the items of a chunk of a heap
+ *  SYNOPSIS
+ *    boolean check_chunk(struct mem_heap *heap, struct chunk *chunk,
+ *        struct check_counts *counts)
+ *  DESCRIPTION
+ *    The items of the chunk go from its first item to the fake right
+ *    buddy, and their sizes must add up to a class, the class of the top
+ *    item.  The split tree of the top item is then followed like in
+ *    carve_items, the left buddies first.  Each item found must have the
+ *    size of the class of its node, and the lr_bit and inh_bit that
+ *    split_buddies gives it.  Two free buddies must have been merged.  A
+ *    free item must be linked into the free list of its class.  The free
+ *    and used items of each class are added to counts, and a free top
+ *    item adds the chunk to the free chunks.
+ *  RETURN VALUE
+ *    0 after printing the first problem found, otherwise 1.
+ ******
+ */
+
+boolean
+check_chunk(struct mem_heap *heap, struct chunk *chunk,
+    struct check_counts *counts)
+{
+    struct array *array = &heap->array;
+    char *end = (char*)chunk->base + chunk->size;
+    char *first = (char*)chunk + sizeof(struct chunk);
+    char *item, *right, *prev, *next;
+    char *stack[CLASS_COUNT];
+    unsigned int classes[CLASS_COUNT];
+    unsigned char bits[CLASS_COUNT];
+    unsigned int i, top = 0;
+    uintptr_t size, total = 0;
+    boolean lr = LEFT, inh = 0;
+
+    for (item = first; item_get_size(item) != 0; item += size * BLOCK_SIZE)
+    {
+        size = item_get_size(item);
+        if (size > (uintptr_t)(end - item) / BLOCK_SIZE)
+        {
+            return check_fail(item, "item past the end of its chunk");
+        }
+        total += size;
+    }
+    i = class_index(total);
+    if (i >= CLASS_COUNT || class_sizes[i] != total)
+    {
+        return check_fail(chunk, "chunk which is not a class");
+    }
+    if (!item_is_in_use(item) || item_get_lr_bit(item) != RIGHT)
+    {
+        return check_fail(item, "bad fake right buddy");
+    }
+
+    item = first;
+    for (;;)
+    {
+        size = item_get_size(item);
+        if (size < class_sizes[i] && i > FIB_K)
+        {
+            // the node is split, its right buddy waits on the stack
+            right = item + class_sizes[i-FIB_K] * BLOCK_SIZE;
+            if (size == class_sizes[i-FIB_K] && !item_is_in_use(item)
+                && item_get_size(right) == class_sizes[i-1]
+                && !item_is_in_use(right))
+            {
+                return check_fail(item, "free buddies not merged");
+            }
+            stack[top] = right;
+            classes[top] = i - 1;
+            bits[top++] = (unsigned char)(RIGHT | inh << 1);
+            inh = lr;
+            lr = LEFT;
+            i = i - FIB_K;
+            continue;
+        }
+        if (size != class_sizes[i])
+        {
+            return check_fail(item, "item of the wrong size");
+        }
+        if (item_get_lr_bit(item) != lr || item_get_inh_bit(item) != inh)
+        {
+            return check_fail(item, "wrong lr_bit or inh_bit");
+        }
+        if (item_is_in_use(item))
+        {
+            counts->used_items[i]++;
+        }
+        else
+        {
+            prev = item_get_prev(item);
+            next = item_get_next(item);
+            if ((prev != NULL && heap_find_chunk(heap, prev) == NULL)
+                || (next != NULL && heap_find_chunk(heap, next) == NULL))
+            {
+                return check_fail(item, "free item linked out of the heap");
+            }
+            if ((prev == NULL ? array->data[i].items != item
+                    : item_get_next(prev) != item)
+                || (next != NULL && item_get_prev(next) != item))
+            {
+                return check_fail(item, "free item not in its free list");
+            }
+            counts->free_items[i]++;
+            if (size == total)
+            {
+                counts->free_chunk_bytes += chunk->size;   // the top item
+            }
+        }
+        if (top == 0)
+        {
+            return 1;
+        }
+        top--;
+        item = stack[top];
+        i = classes[top];
+        lr = bits[top] & 1;
+        inh = bits[top] >> 1;
+    }
+}
+
+
+/* checks that the chunk index is sorted, that it has an entry for every
+ * chunk of the heap and no other entry of the heap
+ */
+static boolean
+check_index(struct mem_heap *heap)
+{
+    struct chunk *lists[2];
+    struct chunk_entry *entry;
+    struct chunk *chunk;
+    unsigned long entries = 0;
+    size_t k;
+    boolean ok = 1;
+    lists[0] = heap->mem_list;
+    lists[1] = heap->direct_list;
+    INDEX_LOCK();
+    for (k = 0; k < 2 && ok; k++)
+    {
+        for (chunk = lists[k]; chunk != NULL && ok; chunk = chunk->next)
+        {
+            entry = index_find(chunk->base);
+            if (entry == NULL || entry->chunk != chunk || entry->heap != heap)
+            {
+                ok = check_fail(chunk, "chunk missing from the chunk index");
+            }
+        }
+    }
+    for (k = 0; k < chunk_index.count && ok; k++)
+    {
+        if (k + 1 < chunk_index.count
+            && chunk_index.entries[k].end > chunk_index.entries[k+1].start)
+        {
+            ok = check_fail(chunk_index.entries[k].chunk,
+                "chunk index not sorted");
+        }
+        if (chunk_index.entries[k].heap == heap)
+        {
+            entries++;
+        }
+    }
+    if (ok && entries != heap->chunk_count + heap->direct_count)
+    {
+        ok = check_fail(heap, "chunk index has chunks the heap has not");
+    }
+    INDEX_UNLOCK();
+    return ok;
+}
+
+
+/****f* mem/mem_heap_check
+ *  NAME
+ *    mem_heap_check - check the consistency of a heap
+ *  SYNOPSIS
+ *    int mem_heap_check(struct mem_heap *heap)
+ *  DESCRIPTION
+ *    Checks every chunk of the mem_list with check_chunk, then every free
+ *    list: its items are free, of the size of the class, with coherent
+ *    prev and next links, as many as free_count and as the free items of
+ *    the class found in the chunks, and the bitmap agrees.  The items in
+ *    use of a class must be its used_count plus its unmerged items, whose
+ *    lists are checked too, and the direct areas, the number of chunks
+ *    and their bytes must match the counters of the heap, and the chunk
+ *    index must hold exactly the chunks of the heap.  Nothing is
+ *    changed, and it takes the lock of the heap, so it can be called
+ *    periodically while other threads run.
+ *  RETURN VALUE
+ *    1 if the heap is consistent, otherwise 0 after printing the first
+ *    problem found on stderr.
+ ******
+ */
+
+int
+mem_heap_check(struct mem_heap *heap)
+{
+    struct array *array = &heap->array;
+    struct check_counts counts;
+    struct chunk *chunk, *prev_chunk = NULL;
+    void *item, *prev;
+    unsigned long chunks = 0, count;
+    size_t chunk_bytes = 0, direct_bytes = 0;
+    unsigned int i;
+    boolean ok = 1;
+
+    memset(&counts, 0, sizeof(counts));
+    HEAP_LOCK(heap);
+    for (chunk = heap->mem_list; chunk != NULL && ok; chunk = chunk->next)
+    {
+        if (chunk->prev != prev_chunk)
+        {
+            ok = check_fail(chunk, "bad link in the mem_list");
+        }
+        else
+        {
+            ok = check_chunk(heap, chunk, &counts);
+        }
+        chunks++;
+        chunk_bytes += chunk->size;
+        prev_chunk = chunk;
+    }
+    if (ok && (chunks != heap->chunk_count || chunk_bytes != heap->chunk_bytes
+            || counts.free_chunk_bytes != heap->free_chunk_bytes))
+    {
+        ok = check_fail(heap, "chunk counters do not match the mem_list");
+    }
+
+    for (i = 0; i < CLASS_COUNT && ok; i++)
+    {
+        count = 0;
+        prev = NULL;
+        for (item = array->data[i].items; item != NULL && ok;
+            item = item_get_next(item))
+        {
+            if (item_get_prev(item) != prev || item_is_in_use(item)
+                || item_get_size(item) != class_sizes[i]
+                || ++count > array->data[i].free_count)
+            {
+                ok = check_fail(item, "bad item in a free list");
+            }
+            prev = item;
+        }
+        for (item = heap->unmerged[i]; item != NULL && ok;
+            item = item_get_next(item))
+        {
+            if (!item_is_in_use(item)
+                || item_get_size(item) != class_sizes[i]
+                || count++ > array->data[i].free_count
+                    + heap->unmerged_count[i])
+            {
+                ok = check_fail(item, "bad item in an unmerged list");
+            }
+        }
+        if (!ok)
+        {
+            break;
+        }
+        if (count != array->data[i].free_count + heap->unmerged_count[i]
+            || counts.free_items[i] != array->data[i].free_count)
+        {
+            ok = check_fail(array->data[i].items, "wrong count of free items");
+        }
+        else if ((array_find_nonempty(array, i) == i)
+            != (array->data[i].items != NULL))
+        {
+            ok = check_fail(array->data[i].items, "wrong bit in the bitmap");
+        }
+        else if (counts.used_items[i]
+            != array->data[i].used_count + heap->unmerged_count[i])
+        {
+            ok = check_fail(array->data[i].items, "wrong count of used items");
+        }
+    }
+
+    chunks = 0;
+    for (chunk = heap->direct_list; chunk != NULL && ok; chunk = chunk->next)
+    {
+        item = (char*)chunk + sizeof(struct chunk);
+        if (((uintptr_t*)item)[0] != ((uintptr_t)1 << 2))
+        {
+            ok = check_fail(item, "bad header of a direct area");
+        }
+        chunks++;
+        direct_bytes += chunk->size;
+    }
+    if (ok && (chunks != heap->direct_count
+            || direct_bytes != heap->direct_bytes))
+    {
+        ok = check_fail(heap, "direct counters do not match the direct_list");
+    }
+    if (ok)
+    {
+        ok = check_index(heap);
+    }
+    HEAP_UNLOCK(heap);
+    return ok;
+}
+
+
+/****f* mem/mem_heap_walk
+ *  NAME
+ *    mem_heap_walk - call a function for every item of a heap
+ *  SYNOPSIS
+ *    void mem_heap_walk(struct mem_heap *heap,
+ *        void (*callback)(void *area, size_t bytes, int used, void *arg),
+ *        void *arg)
+ *  DESCRIPTION
+ *    Calls callback for every item of every chunk of the heap, in the
+ *    order of the memory, and for every direct area, with the area of the
+ *    item, its usable bytes, whether it is in use and arg.  The items the
+ *    allocator keeps for itself count as used: the array, the regions of
+ *    the slabs, whose slots are not reported one by one, the items of the
+ *    thread caches and the unmerged items of the lazy mode.  The lock of
+ *    the heap is held, so callback must not use the heap.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+mem_heap_walk(struct mem_heap *heap,
+    void (*callback)(void *area, size_t bytes, int used, void *arg),
+    void *arg)
+{
+    struct chunk *chunk;
+    char *item;
+    HEAP_LOCK(heap);
+    for (chunk = heap->mem_list; chunk != NULL; chunk = chunk->next)
+    {
+        for (item = (char*)chunk + sizeof(struct chunk);
+            item_get_size(item) != 0;
+            item += item_get_size(item) * BLOCK_SIZE)
+        {
+            callback(item_get_area(item), item_get_bytes(item),
+                item_is_in_use(item), arg);
+        }
+    }
+    for (chunk = heap->direct_list; chunk != NULL; chunk = chunk->next)
+    {
+        item = (char*)chunk + sizeof(struct chunk);
+        callback(item_get_area(item), item_get_bytes(item), 1, arg);
+    }
+    HEAP_UNLOCK(heap);
+}
+
+
+/****f* mem/mem_heap_of
+ *  NAME
+ *    mem_heap_of - find the heap of an address
+ *  SYNOPSIS
+ *    struct mem_heap *mem_heap_of(void *p)
+ *  DESCRIPTION
+ *    Looks for the chunk holding p in the chunk index, by a binary search
+ *    on the chunks of all the heaps, without taking the lock of any heap.
+ *    It tells whether a pointer comes from the allocator, and which heap
+ *    an area must be freed to, such as with mem_heap_free(mem_heap_of(p),
+ *    p).  An address of the default heap gives the default heap, whose
+ *    areas mem_heap_free sends through mem_free.  Any address of a chunk
+ *    is found, including the headers and the free items, so it does not
+ *    tell whether p is an area in use.
+ *  RETURN VALUE
+ *    The heap whose chunks hold p, or NULL if p is not in any chunk.
+ ******
+ */
+
+struct mem_heap*
+mem_heap_of(void *p)
+{
+    struct chunk_entry *entry;
+    struct mem_heap *heap = NULL;
+    INDEX_LOCK();
+    entry = index_find(p);
+    if (entry != NULL)
+    {
+        heap = entry->heap;
+    }
+    INDEX_UNLOCK();
+    return heap;
+}
+
+
+/****f* mem/mem_heap_set_retain
+ *  NAME
+ *    mem_heap_set_retain - set the retention policy of the free chunks
+ *  SYNOPSIS
+ *    void mem_heap_set_retain(struct mem_heap *heap, size_t retain,
+ *        size_t threshold)
+ *  DESCRIPTION
+ *    When the free chunks of the heap total more than threshold bytes,
+ *    they are returned to the OS until at most retain bytes are left. 
+ *    Setting retain to 0 and threshold to 0 releases every chunk as soon
+ *    as it is free, and a threshold bigger than retain avoids mapping and
+ *    unmapping the same chunk again and again.  The default is to keep
+ *    every chunk until mem_heap_trim is called.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+mem_heap_set_retain(struct mem_heap *heap, size_t retain, size_t threshold)
+{
+    HEAP_LOCK(heap);
+    heap->retain_bytes = retain;
+    heap->release_threshold = threshold < retain ? retain : threshold;
+    if (heap->free_chunk_bytes > heap->release_threshold)
+    {
+        heap_trim(heap, heap->retain_bytes);
+    }
+    HEAP_UNLOCK(heap);
+}
+
+
+/****f* mem/mem_heap_trim
+ *  NAME
+ *    mem_heap_trim - return all the free chunks of a heap to the OS
+ *  SYNOPSIS
+ *    void mem_heap_trim(struct mem_heap *heap)
+ *  DESCRIPTION
+ *    The regions of slabs which are all empty are given back to the heap
+ *    first, and then the unmerged items of the lazy mode are merged.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+mem_heap_trim(struct mem_heap *heap)
+{
+    HEAP_LOCK(heap);
+#if MEM_ALLOC_SLABS
+    slab_trim(heap);
+#endif
+    merge_all(heap);
+    heap_trim(heap, 0);
+    HEAP_UNLOCK(heap);
+}
+
+
+/****f* mem/mem_heap_set_growth
+ *  NAME
+ *    mem_heap_set_growth - set the size of the new chunks of a heap
+ *  SYNOPSIS
+ *    void mem_heap_set_growth(struct mem_heap *heap, size_t min_chunk,
+ *        unsigned int shift)
+ *  DESCRIPTION
+ *    The chunks allocated from the OS will be at least min_chunk bytes and
+ *    at least the size of the heap divided by 2 to the power shift.  A
+ *    min_chunk of 0 and a big shift give chunks as small as possible.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+mem_heap_set_growth(struct mem_heap *heap, size_t min_chunk,
+    unsigned int shift)
+{
+    HEAP_LOCK(heap);
+    heap->min_chunk_bytes = min_chunk;
+    heap->growth_shift = shift < sizeof(size_t) * CHAR_BIT
+        ? shift : (unsigned int)(sizeof(size_t) * CHAR_BIT - 1);
+    HEAP_UNLOCK(heap);
+}
+
+
+/* the same for the default heap */
+void
+mem_set_growth(size_t min_chunk, unsigned int shift)
+{
+    mem_heap_set_growth(&default_heap, min_chunk, shift);
+}
+
+
+/****f* mem/mem_heap_set_lazy
+ *  NAME
+ *    mem_heap_set_lazy - set the lazy merging of the freed items of a heap
+ *  SYNOPSIS
+ *    void mem_heap_set_lazy(struct mem_heap *heap, unsigned int max)
+ *  DESCRIPTION
+ *    With max bigger than 0, the items freed are not merged with their
+ *    buddies but kept on a list of their class, up to max items per
+ *    class, and given to the next allocations of the class without
+ *    splitting anything.  This avoids splitting a big item down to a size
+ *    and merging it back up again and again when the same size is
+ *    allocated and freed.  The items are merged when the list of the class
+ *    has more than max items, half of them, or when no free item is big
+ *    enough for an allocation, or by mem_heap_trim.  A max of 0, the
+ *    default, merges the items when they are freed, and merges the items
+ *    kept.
+ *  RETURN VALUE
+ *    Nothing is returned by this function.
+ ******
+ */
+
+void
+mem_heap_set_lazy(struct mem_heap *heap, unsigned int max)
+{
+    unsigned int i;
+    HEAP_LOCK(heap);
+    heap->lazy_max = max;
+    for (i = 0; i < CLASS_COUNT; i++)
+    {
+        merge_unmerged(heap, i, max);
+    }
+    HEAP_UNLOCK(heap);
+}
+
+
+/* the same for the default heap */
+void
+mem_set_lazy(unsigned int max)
+{
+    mem_heap_set_lazy(&default_heap, max);
+}
+
+
+void
+mem_realloc_stats(struct mem_realloc_stats *stats)
+{
+    mem_heap_realloc_stats(&default_heap, stats);
+}
+
+
+void
+mem_stats(struct mem_stats *stats)
+{
+    mem_heap_stats(&default_heap, stats);
+}
+
+
+int
+mem_check()
+{
+    return mem_heap_check(&default_heap);
+}
+
+
+void
+mem_walk(void (*callback)(void *area, size_t bytes, int used, void *arg),
+    void *arg)
+{
+    mem_heap_walk(&default_heap, callback, arg);
+}
+
+
+void
+mem_set_retain(size_t retain, size_t threshold)
+{
+    mem_heap_set_retain(&default_heap, retain, threshold);
+}
+
+
+void
+mem_trim()
+{
+    mem_heap_trim(&default_heap);
+}
+
+
+#if MEM_ALLOC_THREADS
+
+#if MEM_ALLOC_HARDEN
+
+/* harden_free for an item going to the cache of the thread, which does
+ * not hold the lock of the default heap
+ */
+static void
+cache_harden_free(void *item)
+{
+    HEAP_LOCK(&default_heap);
+    harden_free(&default_heap, item);
+    HEAP_UNLOCK(&default_heap);
+}
+
+#else
+#define cache_harden_free(item) ((void)0)
+#endif
+
+
+/****f* mem/default_alloc
+ *  NAME
+ *    default_alloc - allocate an item from the default heap
+ *  SYNOPSIS
+ *    void *default_alloc(size_t x)
+ *  DESCRIPTION
+ *    Allocates an item for x bytes, from the cache of the thread when it
+ *    is small enough, and counts it.  Unlike mem_alloc it records no trace
+ *    event, so that mem_realloc records only its own.  Without threads
+ *    the global functions are the functions of the default heap.
+ *  RETURN VALUE
+ *    The item, or NULL if x is too big or the OS has no more memory.
  ******
  */
 
 void*
-split_item(struct array *array, unsigned int i, void *item, uintptr_t n)
+default_alloc(size_t x)
 {
-    void *curr, *left, *right;
-    uintptr_t szl, szr;
-    boolean inh_l, inh_r;
-    unsigned int i_left, i_right;
-    curr = item;
-    while (array->data[i-1].size >= n && i > 4)
-    {
-        szl = array->data[i-4].size;
-        szr = array->data[i-1].size;
-        inh_l = item_get_lr_bit(curr);
-        inh_r = item_get_inh_bit(curr);
-        left = curr;
-        right = ((char*)curr) + szl * BLOCK_SIZE;
-        item_set_size(left, szl);
-        item_set_size(right, szr);
-        item_set_lr_bit(left, LEFT);
-        item_set_lr_bit(right, RIGHT);
-        item_set_in_use(left, 0);
-        item_set_in_use(right, 0);
-        item_set_inh_bit(left, inh_l);
-        item_set_inh_bit(right, inh_r);
-        i_left = i - 4;
-        i_right = i - 1;
-        if (szl >= n)
-        {
-            insert_item(array, i_right, right);
-            i = i_left;
-            curr = left;
-        }
-        else
+    void *item;
+    debug("mem_alloc: %lu bytes\n", (unsigned long)x);
+    if (harden_bytes(x) <= CACHE_MAX_BLOCKS * BLOCK_SIZE - HEADER_SIZE)
+    {
+        item = cache_alloc(&cache, BLOCKS(harden_bytes(x) + HEADER_SIZE));
+        if (item != NULL)
         {
-            insert_item(array, i_left, left);
-            i = i_right;
-            curr = right;
+            count_alloc(&cache.counters, x, item);
+            harden_alloc(item, 0, x);
         }
+        return item;
     }
-    return curr;
+    HEAP_LOCK(&default_heap);
+    item = heap_alloc_item(&default_heap, x);
+    if (item != NULL)
+    {
+        count_alloc(&default_heap.counters, x, item);
+    }
+    HEAP_UNLOCK(&default_heap);
+    if (item != NULL)
+    {
+        harden_alloc(item, 0, x);
+    }
+    return item;
 }
 
 
-/****f* mem/alloc_new_item
+/****f* mem/default_free
  *  NAME
- *    alloc_new_item - allocate a new item from the OS
+ *    default_free - free an item of the default heap
  *  SYNOPSIS
- *    void *alloc_new_item(unsigned int n);
+ *    void default_free(void *item, size_t x)
  *  DESCRIPTION
- *    The function alloc_new_item allocates a new item of n blocks.  It also
- *    allocates a fake empty buddy, so that it does not merge more than it
- *    should.  The fake right buddy is marked in use in order to stop the
- *    merging of buddies.
- *
- *    The whole thing is prefixed by a pointer in order to make it a singly
- *    linked list, mem_list, which is used to free all the elements
- *    allocated from the OS.
- *
- *    The number passed in the n parameter is always a number belonging to
- *    the generalized Fibonacci sequence.
+ *    The counterpart of default_alloc.  x is the size given to
+ *    mem_free_sized, or 0, which fits any item: once the item is checked,
+ *    its class is checked against the class of x as in
+ *    mem_heap_free_sized.
  *  RETURN VALUE
- *    This function returns the address of new item allocated.
+ *    Does not return anything.
  ******
  */
 
-void*
-alloc_new_item(unsigned int n)
-{
-    void *tmp, *fake_right, *item;
-    debug("alloc_new_item: allocate %d blocks, %d bytes\n", n, (int)(BLOCK_SIZE * n + sizeof(void*)*2));
-    tmp = malloc(BLOCK_SIZE * n + sizeof(void*)*2);
-    *((void**)tmp) = mem_list;
-    mem_list = tmp;
-    fake_right = ((char*)tmp) + BLOCK_SIZE * n + sizeof(void*);
-    item_set_size(fake_right, 0);
-    item_set_lr_bit(fake_right, RIGHT);
-    item_set_in_use(fake_right, 1);
-    item = ((char*)tmp) + sizeof(void*);
-    item_set_size(item, n);
-    item_set_lr_bit(item, LEFT);
-    return item;
+void
+default_free(void *item, size_t x)
+{
+    if (!item_is_direct(item) && item_get_size(item) <= CACHE_MAX_BLOCKS)
+    {
+        cache_harden_free(item);
+        check_free_class(item, x);
+        cache_free(&cache, item);
+        return;
+    }
+    HEAP_LOCK(&default_heap);
+    harden_free(&default_heap, item);
+    check_free_class(item, x);
+    free_item(&default_heap, item);
+    HEAP_UNLOCK(&default_heap);
 }
 
+#endif /* MEM_ALLOC_THREADS */
+
 
 /****f* mem/mem_alloc
  *  NAME
  *    mem_alloc - allocate an area block of a minumum number of bytes 
  *  SYNOPSIS
- *    void *mem_alloc(unsigned int x)
+ *    void *mem_alloc(size_t x)
  *  DESCRIPTION
- *    Allocates minimum x bytes.
- *
- *    First we check if the array contains an element that we can use in
- *    order to hold x bytes.
- *
- *    If such element is found we remove it from
- *    the array.
+ *    Allocates minimum x bytes from the default heap, the small sizes from
+ *    its slabs.
  *
- *    Otherwise we stretch the array if needed because the free lists in the
- *    array have to follow the generalized Fibonacci sequence.  So if we
- *    need to allocate a very big item, we have to fill everything that
- *    comes in between the end of the array and the place where the big item
- *    will have to go.  Then we can allocate the area from the OS.  The rule
- *    is to never allocate the same amount or less from the OS.
- *
- *    Once we have the item, we split it as much as needed.  Then we set the
- *    in_use bit of the item and return the area.
+ *    In the thread-safe mode small sizes are taken from the cache of the
+ *    thread instead, and the other sizes are allocated while holding the
+ *    lock.
  *  RETURN VALUE
- *    An area of minimum x bytes.
+ *    An area of minimum x bytes, or NULL if x is too big or the OS has no
+ *    more memory.
  ******
  */
 
 void*
-mem_alloc(unsigned int x)
+mem_alloc(size_t x)
 {
-    unsigned int i;
-    void *item, *area;
-    uintptr_t n = BLOCKS(x + HEADER_SIZE);
-    debug("mem_alloc: needed blocks: %d\n", n);
-
-    // try to find an item without increasing the array
-    i = 0;
-    while (i < array.size && (array.data[i].size < n || array.data[i].items == NULL))
+#if MEM_ALLOC_THREADS
+    void *item = default_alloc(x);
+    if (item == NULL)
     {
-        i++;
+        return NULL;
     }
+    trace(MEM_TRACE_ALLOC, x, item, NULL);
+    debug("allocated %lu bytes at %p\n", (unsigned long)x,
+        item_get_area(item));
+    return item_get_area(item);
+#else
+    return mem_heap_alloc(&default_heap, x);
+#endif
+}
 
-    // if not found, then increase the array and then allocate
-    if (i == array.size)
-    {
-        i--;
-        do 
-        {
-            array_inc_size(&array);
-            i++;
-        } while (array.data[i].size < n);
 
-        item = alloc_new_item((unsigned int)array.data[i].size);
-    }
-    else
+/****f* mem/mem_alloc_aligned
+ *  NAME
+ *    mem_alloc_aligned - allocate an aligned area
+ *  SYNOPSIS
+ *    void *mem_alloc_aligned(size_t alignment, size_t x)
+ *  DESCRIPTION
+ *    The same as mem_heap_alloc_aligned for the default heap.  The area is
+ *    freed by mem_free.  A word alignment is a plain mem_alloc.
+ *  RETURN VALUE
+ *    An area of minimum x bytes, or NULL if alignment is not a power of 2,
+ *    if x is too big or if the OS has no more memory.
+ ******
+ */
+
+void*
+mem_alloc_aligned(size_t alignment, size_t x)
+{
+    if (alignment != 0 && alignment <= HEADER_SIZE
+        && (alignment & (alignment - 1)) == 0)
     {
-        item = take_item(&array, i);
+        return mem_alloc(x);        // from the cache of the thread
     }
+    return mem_heap_alloc_aligned(&default_heap, alignment, x);
+}
 
-    // split if needed to
-    item = split_item(&array, i, item, n);
-    item_set_in_use(item, 1);
-    area = item_get_area(item);
-    debug("allocated %d bytes at %p\n", x, area);
-    return area;
+
+/****f* mem/mem_free
+ *  NAME
+ *    mem_free - put the item back into the free list
+ *  SYNOPSIS
+ *    void mem_free(void *area)
+ *  DESCRIPTION
+ *    Return the item after use to the free list of the default heap.
+ *
+ *    In the thread-safe mode small items go to the cache of the thread. 
+ *    When a list of the cache becomes too long, a batch of its items is
+ *    returned to the shared heap.
+ *  RETURN VALUE
+ *    Does not return anything.
+ ******
+ */
+
+void
+mem_free(void *area)
+{
+#if MEM_ALLOC_THREADS
+    void *item = item_from_area(area);
+    debug("freeing %p\n", area);
+    trace(MEM_TRACE_FREE, 0, item, NULL);
+    default_free(item, 0);
+#else
+    mem_heap_free(&default_heap, area);
+#endif
 }
 
 
-/****f* mem/item_get_buddy
+/****f* mem/mem_free_sized
  *  NAME
- *    item_get_buddy - given an item, return its buddy
+ *    mem_free_sized - free an area whose size is known
  *  SYNOPSIS
- *  void *item_get_buddy(struct array *array, void *item, unsigned int i,
- *      unsigned int *ibuddy);
+ *    void mem_free_sized(void *area, size_t x)
  *  DESCRIPTION
- *    Calculates the address of the buddy and returns it.  It uses the fact
- *    that the free list containing the size of the buddy is either 3 cells
- *    to the left or 3 cells to the right, depending on whether the item is
- *    is a left or the right buddy.  Then, knowing the size, it's easy to
- *    know the location of the buddy.
+ *    The same as mem_heap_free_sized for the default heap.  In the
+ *    thread-safe mode the default heap has no slabs, and the area goes
+ *    through the cache as in mem_free.
  *  RETURN VALUE
- *    The function retuens the address of the buddy.  It also sets the
- *    address pointed by ibuddy, which corresponds to the index in the array
- *    where it would be inserted.  That is, the index of the array that
- *    gives the location of the free list of the same size as the buddy.
+ *    Does not return anything.
  ******
  */
 
-void*
-item_get_buddy(struct array *array, void *item, unsigned int i,
-    unsigned int *ibuddy)
+void
+mem_free_sized(void *area, size_t x)
 {
-    uintptr_t size, buddy_size;
-    if (item_get_lr_bit(item) == LEFT)
-    {
-        *ibuddy = i + 3;
-        size = item_get_size(item);
-        return ((char*)item) + size * BLOCK_SIZE;
-    }
-    else
+#if MEM_ALLOC_THREADS
+    void *item = item_from_area(area);
+    debug("freeing %p, %lu bytes\n", area, (unsigned long)x);
+    trace(MEM_TRACE_FREE, 0, item, NULL);
+    default_free(item, x);
+#else
+    mem_heap_free_sized(&default_heap, area, x);
+#endif
+}
+
+
+/****f* mem/mem_alloc_batch
+ *  NAME
+ *    mem_alloc_batch - allocate many areas of the same size
+ *  SYNOPSIS
+ *    unsigned int mem_alloc_batch(size_t x, unsigned int count,
+ *        void **areas)
+ *  DESCRIPTION
+ *    The same as mem_heap_alloc_batch for the default heap.  In the
+ *    thread-safe mode the small sizes are taken from the cache of the
+ *    thread one by one, as its refills are already done by batches.
+ *  RETURN VALUE
+ *    The number of areas allocated, less than count only if the OS has no
+ *    more memory.
+ ******
+ */
+
+unsigned int
+mem_alloc_batch(size_t x, unsigned int count, void **areas)
+{
+#if MEM_ALLOC_THREADS
+    unsigned int k;
+    if (harden_bytes(x) <= CACHE_MAX_BLOCKS * BLOCK_SIZE - HEADER_SIZE)
     {
-        *ibuddy = i - 3;
-        buddy_size = array->data[*ibuddy].size;
-        return ((char*)item) - buddy_size * BLOCK_SIZE;
+        for (k = 0; k < count; k++)
+        {
+            areas[k] = mem_alloc(x);
+            if (areas[k] == NULL)
+            {
+                break;
+            }
+        }
+        return k;
     }
+#endif
+    return mem_heap_alloc_batch(&default_heap, x, count, areas);
 }
 
 
-/****f* mem/delete_item
+/****f* mem/mem_free_batch
  *  NAME
- *    delete_item - delete an item from the free list at a specified index
+ *    mem_free_batch - free many areas
  *  SYNOPSIS
- *    void delete_item(struct array *array, unsigned int i, void *item)
+ *    void mem_free_batch(void **areas, unsigned int count)
  *  DESCRIPTION
- *    The function delete_item deletes one item, which it finds by address,
- *    from the free list specified by the index i in the array.  It deletes
- *    in two steps: first it finds the item, then it deletes it.  The delete
- *    operation is like a normal delete operation from a doubly linked list,
- *    except that if it's the first item, then the entry in the array is
- *    modified to point to the new head.
- *
- *    It is different from take_item, which removes any item from the free
- *    list.  The item deleted from the list can still be used (it is not
- *    freed), and can be inserted back.
+ *    The same as mem_heap_free_batch for the default heap.  In the
+ *    thread-safe mode the small items go to the cache of the thread, and
+ *    the others are moved to the start of the array and freed together,
+ *    so that the array is reordered.
  *  RETURN VALUE
- *    Does not return anything
+ *    Does not return anything.
  ******
  */
 
 void
-delete_item(struct array *array, unsigned int i, void *item)
+mem_free_batch(void **areas, unsigned int count)
 {
-    void *curr = array->data[i].items;
-    while (curr != NULL && curr != item)
-    {
-        curr = item_get_next(curr);
-    }
-    if (curr != NULL)
+#if MEM_ALLOC_THREADS
+    unsigned int k, m = 0;
+    void *item;
+    for (k = 0; k < count; k++)
     {
-        void *prev = item_get_prev(curr);
-        void *next = item_get_next(curr);
-        if (prev != NULL)
+        item = item_from_area(areas[k]);
+        if (!item_is_direct(item) && item_get_size(item) <= CACHE_MAX_BLOCKS)
         {
-            item_set_next(prev, next);
+            trace(MEM_TRACE_FREE, 0, item, NULL);
+            cache_harden_free(item);
+            cache_free(&cache, item);
         }
-        if (next != NULL)
+        else
         {
-            item_set_prev(next, prev);
+            areas[m++] = areas[k];
         }
-        if (curr == array->data[i].items) {
-            array->data[i].items = next;
-        }
-        
     }
+    count = m;
+#endif
+    free_batch(&default_heap, areas, count);
 }
 
 
-/****f* mem/coalesce
+/****f* mem/mem_usable_size
  *  NAME
- *    coalesce - merge buddies until an buddy in use is found.
+ *    mem_usable_size - the number of bytes usable in an area
+ *  SYNOPSIS
+ *    size_t mem_usable_size(void *area)
  *  DESCRIPTION
- *    The coalesce function makes the opposite of splitting: it merges
- *    buddies that are not in use, and stops when it finds a buddy which is
- *    in use, which will happen sooner or later because the item at the top
- *    had a fake right buddy which is marked in use.
- *  SYNOPSIS 
- *    void coalesce(struct array *array, unsigned int);
+ *    The area of the default heap can hold more bytes than asked, because
+ *    its size was rounded up to its class.
  *  RETURN VALUE
- *    This function returns nothing.
+ *    The size of the slot or of the item of the area, without its header.
  ******
  */
 
-void
-coalesce(struct array *array, unsigned int i)
+size_t
+mem_usable_size(void *area)
 {
-    unsigned int ibuddy;
-    void *item, *buddy, *left, *right;
-    boolean lr_bit, inh_bit;
-    uintptr_t size;
-    item = array->data[i].items;
-    buddy = item_get_buddy(array, item, i, &ibuddy);
-    while (!item_is_in_use(buddy)
-        && array->data[ibuddy].size == item_get_size(buddy))
+#if MEM_ALLOC_THREADS && !MEM_ALLOC_HARDEN
+    // no slabs in the default heap, its small sizes are in the caches
+    return item_get_bytes(item_from_area(area));
+#else
+    return mem_heap_usable_size(&default_heap, area);
+#endif
+}
+
+
+/****f* mem/mem_realloc
+ *  NAME
+ *    mem_realloc - change the size of an area
+ *  SYNOPSIS
+ *    void *mem_realloc(void *area, size_t x)
+ *  DESCRIPTION
+ *    The same as mem_heap_realloc for the default heap.  In the
+ *    thread-safe mode, when the area has to move, it goes through
+ *    default_alloc and default_free, so that the caches are used.
+ *  RETURN VALUE
+ *    The area, which can have moved, or NULL if x is too big or the OS has
+ *    no more memory, and the area is left as it was.
+ ******
+ */
+
+void*
+mem_realloc(void *area, size_t x)
+{
+#if MEM_ALLOC_THREADS
+    void *item, *new_item;
+    size_t old_bytes;
+    boolean in_place;
+    if (area == NULL)
     {
-        delete_item(array, i, item);
-        delete_item(array, ibuddy, buddy);
-        if (item_get_lr_bit(item) == LEFT)
-        {
-            left = item;
-            right = buddy;
-            i += 4;
-        }
-        else
+        return mem_alloc(x);
+    }
+    debug("realloc %p to %lu bytes\n", area, (unsigned long)x);
+    item = item_from_area(area);
+    new_item = item;
+    HEAP_LOCK(&default_heap);
+    old_bytes = checked_bytes(&default_heap, item);
+    in_place = realloc_in_place(&default_heap, item, x);
+    if (in_place)
+    {
+        count_alloc(&default_heap.counters, x, item);
+        harden_alloc(item, old_bytes < x ? old_bytes : x, x);
+    }
+    HEAP_UNLOCK(&default_heap);
+    if (!in_place)
+    {
+        new_item = default_alloc(x);
+        if (new_item == NULL)
         {
-            left = buddy;
-            right = item;
-            i += 1;
+            return NULL;
         }
-        item = left;
-        size = array->data[i].size;	// new i
-        lr_bit = item_get_inh_bit(left);
-        inh_bit = item_get_inh_bit(right);
-        item_set_lr_bit(item, lr_bit);
-        item_set_inh_bit(item, inh_bit);
-        item_set_size(item, size);
-        item_set_in_use(item, 0);
-        buddy = item_get_buddy(array, item, i, &ibuddy);
-        insert_item(array, i, item);
+        memcpy(item_get_area(new_item), area, old_bytes < x ? old_bytes : x);
+        default_free(item, 0);
     }
+    trace(MEM_TRACE_REALLOC, x, new_item, area);
+    return item_get_area(new_item);
+#else
+    return mem_heap_realloc(&default_heap, area, x);
+#endif
 }
 
 
-/****f* mem/mem_free
+/****f* mem/mem_trace_enable
  *  NAME
- *    mem_free - put the item back into the free list
+ *    mem_trace_enable - start or stop recording events
  *  SYNOPSIS
- *    void mem_free(void *area)
+ *    void mem_trace_enable(int on)
  *  DESCRIPTION
- *    Return the item after use to the free list.  The first thing is to get
- *    the item pointer from the address from the area.  Using the header,
- *    it's easy to find the size, and, having found the size, we have the
- *    index which must match the size field of a free list in the array.
+ *    Starts recording the alloc, free and realloc calls of all the heaps
+ *    into the event ring when on is not 0, and stops otherwise.  Starting
+ *    empties the ring.  Without MEM_ALLOC_TRACE it does nothing.
  *  RETURN VALUE
  *    Does not return anything.
  ******
  */
 
 void
-mem_free(void *area)
+mem_trace_enable(int on)
 {
-    unsigned int i;
-    void *item;
-    uintptr_t size;
+#if MEM_ALLOC_TRACE
+    if (on && !trace_on)
+    {
+        trace_pos = 0;
+    }
+    trace_on = on;
+#else
+    (void)on;
+#endif
+}
 
-    debug("freeing %p\n", area);
 
-    item = item_from_area(area);
-    size = item_get_size(item);
-    i = 0;
-    while (size != array.data[i].size)
+/****f* mem/mem_trace_read
+ *  NAME
+ *    mem_trace_read - copy the last recorded events
+ *  SYNOPSIS
+ *    unsigned int mem_trace_read(struct mem_trace_event *events,
+ *        unsigned int max)
+ *  DESCRIPTION
+ *    Copies at most max of the last events of the ring into events, the
+ *    oldest first, and fills their class, the index in the sequence of
+ *    the size of the item.  Events recorded by other threads during the
+ *    copy can be torn, so the ring should be read after mem_trace_enable(0)
+ *    or when the other threads are quiet.
+ *  RETURN VALUE
+ *    The number of events copied.
+ ******
+ */
+
+unsigned int
+mem_trace_read(struct mem_trace_event *events, unsigned int max)
+{
+#if MEM_ALLOC_TRACE
+    unsigned long pos = trace_pos;
+    unsigned long count = pos < MEM_TRACE_SIZE ? pos : MEM_TRACE_SIZE;
+    unsigned long k;
+    if (count > max)
     {
-        i++;
+        count = max;
     }
-    item_set_in_use(item, 0);
-    insert_item(&array, i, item);
-    coalesce(&array, i);
+    for (k = 0; k < count; k++)
+    {
+        events[k] = trace_ring[(pos - count + k) & (MEM_TRACE_SIZE - 1)];
+        events[k].cls = (unsigned short)class_index(events[k].blocks);
+    }
+    return (unsigned int)count;
+#else
+    (void)events;
+    (void)max;
+    return 0;
+#endif
+}
+
+
+/****f* mem/mem_trace_dump
+ *  NAME
+ *    mem_trace_dump - write the recorded events to a file
+ *  SYNOPSIS
+ *    int mem_trace_dump(const char *path)
+ *  DESCRIPTION
+ *    Writes the events returned by mem_trace_read, as they are in memory,
+ *    to the file path.  The ring is copied first, so the file can be
+ *    written with the allocator still recording.
+ *  RETURN VALUE
+ *    The number of events written, or -1 if the file could not be written.
+ ******
+ */
+
+int
+mem_trace_dump(const char *path)
+{
+    static struct mem_trace_event events[MEM_TRACE_SIZE];
+    unsigned int count;
+    FILE *f;
+    count = mem_trace_read(events, MEM_TRACE_SIZE);
+    f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    if (fwrite(events, sizeof(events[0]), count, f) != count)
+    {
+        fclose(f);
+        return -1;
+    }
+    if (fclose(f) != 0)
+    {
+        return -1;
+    }
+    return (int)count;
 }
@@ -1,9 +1,125 @@
 #ifndef MEM_H
 #define MEM_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 void mem_init(void);
 void mem_finalize(void);
-void *mem_alloc(unsigned int x);
+void *mem_alloc(size_t x);
+void *mem_alloc_aligned(size_t alignment, size_t x);
 void mem_free(void *area);
+void mem_free_sized(void *area, size_t x);
+unsigned int mem_alloc_batch(size_t x, unsigned int count, void **areas);
+/* reorders areas: sorts it by address in place, and in the thread-safe
+ * mode first moves the areas which do not go to the cache to its start
+ */
+void mem_free_batch(void **areas, unsigned int count);
+void *mem_realloc(void *area, size_t x);
+size_t mem_usable_size(void *area);
+
+struct mem_heap;
+
+struct mem_heap *mem_heap_create(void);
+void mem_heap_destroy(struct mem_heap *heap);
+void *mem_heap_alloc(struct mem_heap *heap, size_t x);
+void *mem_heap_alloc_aligned(struct mem_heap *heap, size_t alignment,
+    size_t x);
+void mem_heap_free(struct mem_heap *heap, void *area);
+void mem_heap_free_sized(struct mem_heap *heap, void *area, size_t x);
+unsigned int mem_heap_alloc_batch(struct mem_heap *heap, size_t x,
+    unsigned int count, void **areas);
+/* reorders areas as mem_free_batch */
+void mem_heap_free_batch(struct mem_heap *heap, void **areas,
+    unsigned int count);
+void *mem_heap_realloc(struct mem_heap *heap, void *area, size_t x);
+size_t mem_heap_usable_size(struct mem_heap *heap, void *area);
+
+/* counters of mem_realloc: calls = in_place + moved */
+struct mem_realloc_stats {
+    unsigned long calls;
+    unsigned long in_place;
+    unsigned long grown;
+    unsigned long shrunk;
+    unsigned long moved;
+};
+
+void mem_realloc_stats(struct mem_realloc_stats *stats);
+void mem_heap_realloc_stats(struct mem_heap *heap,
+    struct mem_realloc_stats *stats);
+
+/* figures returned by mem_stats, sizes of items include their header */
+#define MEM_STATS_CLASSES 160
+
+struct mem_class_stats {
+    size_t size;                /* bytes of an item of the class */
+    unsigned long free;         /* items in the free list */
+    unsigned long used;         /* items allocated */
+};
+
+struct mem_stats {
+    uint64_t requested;         /* bytes asked by all the allocations */
+    uint64_t handed_out;        /* usable bytes of the areas given */
+    unsigned long allocations;
+    size_t used_bytes;          /* bytes of the items in use */
+    size_t free_bytes;          /* bytes of the free items */
+    size_t largest_free;        /* bytes of the biggest free item */
+    unsigned long chunks;       /* chunks obtained from the OS */
+    size_t chunk_bytes;
+    unsigned long direct;       /* direct areas, each in its own chunk */
+    size_t direct_bytes;
+    unsigned long splits;
+    unsigned long merges;
+    unsigned long slabs;        /* slabs of small slots */
+    unsigned long slots;        /* slots in use */
+    unsigned int classes;       /* valid entries of cls */
+    struct mem_class_stats cls[MEM_STATS_CLASSES];
+};
+
+void mem_stats(struct mem_stats *stats);
+void mem_heap_stats(struct mem_heap *heap, struct mem_stats *stats);
+
+int mem_check(void);
+int mem_heap_check(struct mem_heap *heap);
+void mem_walk(void (*callback)(void *area, size_t bytes, int used, void *arg),
+    void *arg);
+void mem_heap_walk(struct mem_heap *heap,
+    void (*callback)(void *area, size_t bytes, int used, void *arg),
+    void *arg);
+
+struct mem_heap *mem_heap_of(void *p);
+
+void mem_trim(void);
+void mem_set_retain(size_t retain, size_t threshold);
+void mem_heap_trim(struct mem_heap *heap);
+void mem_heap_set_retain(struct mem_heap *heap, size_t retain,
+    size_t threshold);
+
+void mem_set_growth(size_t min_chunk, unsigned int shift);
+void mem_heap_set_growth(struct mem_heap *heap, size_t min_chunk,
+    unsigned int shift);
+
+void mem_set_lazy(unsigned int max);
+void mem_heap_set_lazy(struct mem_heap *heap, unsigned int max);
+
+/* event ring, see mem_trace_enable */
+#define MEM_TRACE_ALLOC 1
+#define MEM_TRACE_FREE 2
+#define MEM_TRACE_REALLOC 3
+
+struct mem_trace_event {
+    uint64_t time;              /* TSC ticks, or clock() without TSC */
+    void *area;                 /* area returned, or freed */
+    void *old_area;             /* area passed to realloc */
+    size_t size;                /* bytes asked, 0 for free */
+    size_t blocks;              /* size of the item, or of the slot */
+    unsigned short cls;         /* class of the item */
+    unsigned char op;           /* MEM_TRACE_ALLOC, FREE or REALLOC */
+};
+
+void mem_trace_enable(int on);
+unsigned int mem_trace_read(struct mem_trace_event *events,
+    unsigned int max);
+int mem_trace_dump(const char *path);
 
 #endif /* MEM_H */
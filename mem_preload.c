@@ -0,0 +1,273 @@
+/****h* mem_alloc/mem_preload
+ *  NAME
+ *    mem_preload - malloc and friends on top of the default heap
+ *  SYNOPSIS
+ *    LD_PRELOAD=./libmem_preload.so program
+ *  DESCRIPTION
+ *    Replaces malloc, free, calloc, realloc, posix_memalign,
+ *    aligned_alloc, memalign, valloc, pvalloc and malloc_usable_size of
+ *    the C library, so that unmodified programs use the allocator.  It is
+ *    built with the thread-safe mode and the mmap chunk source: getting
+ *    chunks from malloc would call this malloc again.  The thread caches
+ *    use the initial-exec TLS model, whose access never allocates.
+ *
+ *    The allocator is initialized by the first call, whichever thread
+ *    makes it, and mem_init installs the fork handlers.
+ *
+ *    Areas are only aligned on a word, and malloc must return areas
+ *    aligned for any type, MIN_ALIGN bytes.  When an area is not aligned
+ *    enough but has room, the pointer returned is moved forward to the
+ *    next aligned address, and the word before it holds the offset from
+ *    the area, shifted left by 3.  The in_use bit (4) of this word is 0,
+ *    while it is 1 in the header of an item in use, so free can tell both
+ *    apart.  Otherwise the area is allocated again by mem_alloc_aligned.
+ ******
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mem.h"
+
+#if !MEM_ALLOC_THREADS || !MEM_ALLOC_MMAP
+#error mem_preload needs MEM_ALLOC_THREADS=1 and MEM_ALLOC_MMAP=1
+#endif
+
+#define EXPORT __attribute__((visibility("default")))
+
+#define MIN_ALIGN (2 * sizeof(void*))
+#define HEADER_IN_USE 4             // in_use bit of the header of an item
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int ready;
+
+
+static void
+init_allocator(void)
+{
+    mem_init();
+    __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+}
+
+
+static inline void
+init(void)
+{
+    if (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE))
+    {
+        pthread_once(&init_once, init_allocator);
+    }
+}
+
+
+/* the area of a pointer returned by this file */
+static inline char*
+area_of(void *p)
+{
+    uintptr_t word = ((uintptr_t*)p)[-1];
+    if (word & HEADER_IN_USE)
+    {
+        return p;
+    }
+    return (char*)p - (word >> 3);
+}
+
+
+static inline size_t
+usable_size(void *p)
+{
+    char *area = area_of(p);
+    return mem_usable_size(area) - (size_t)((char*)p - area);
+}
+
+
+/* moves p forward inside the area until it is aligned, if the area is big
+ * enough, and returns it, or NULL
+ */
+static inline void*
+align_in(char *area, size_t align, size_t size)
+{
+    char *p = (char*)(((uintptr_t)area + align - 1) & ~(uintptr_t)(align - 1));
+    if (p == area)
+    {
+        return p;
+    }
+    if ((size_t)(p - area) + size > mem_usable_size(area))
+    {
+        return NULL;
+    }
+    ((uintptr_t*)p)[-1] = (uintptr_t)(p - area) << 3;
+    return p;
+}
+
+
+static void*
+alloc_aligned(size_t align, size_t size)
+{
+    char *area;
+    void *p;
+    init();
+    // most of the time the area is aligned or has room to move
+    area = mem_alloc(size);
+    if (area == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    p = align_in(area, align, size);
+    if (p == NULL)
+    {
+        mem_free(area);
+        p = mem_alloc_aligned(align, size);
+        if (p == NULL)
+        {
+            errno = ENOMEM;
+        }
+    }
+    return p;
+}
+
+
+EXPORT void*
+malloc(size_t size)
+{
+    return alloc_aligned(MIN_ALIGN, size);
+}
+
+
+EXPORT void
+free(void *p)
+{
+    if (p != NULL)
+    {
+        mem_free(area_of(p));
+    }
+}
+
+
+EXPORT void*
+calloc(size_t n, size_t size)
+{
+    size_t total;
+    void *p;
+    if (__builtin_mul_overflow(n, size, &total))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    p = alloc_aligned(MIN_ALIGN, total);
+    if (p != NULL)
+    {
+        memset(p, 0, total);
+    }
+    return p;
+}
+
+
+EXPORT void*
+realloc(void *p, size_t size)
+{
+    char *area;
+    void *q;
+    size_t old;
+    if (p == NULL)
+    {
+        return malloc(size);
+    }
+    if (size == 0)
+    {
+        free(p);
+        return NULL;
+    }
+    area = area_of(p);
+    if (area == p)
+    {
+        // mem_realloc keeps the area in place when it can
+        area = mem_realloc(area, size);
+        if (area == NULL)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (((uintptr_t)area & (MIN_ALIGN - 1)) == 0)
+        {
+            return area;
+        }
+        p = area;
+        old = size;
+    }
+    else
+    {
+        old = usable_size(p);
+    }
+    q = malloc(size);
+    if (q != NULL)
+    {
+        memcpy(q, p, old < size ? old : size);
+        free(p);
+    }
+    return q;
+}
+
+
+EXPORT int
+posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+    if (align % sizeof(void*) != 0 || (align & (align - 1)) != 0)
+    {
+        return EINVAL;
+    }
+    p = alloc_aligned(align < MIN_ALIGN ? MIN_ALIGN : align, size);
+    if (p == NULL)
+    {
+        return ENOMEM;
+    }
+    *memptr = p;
+    return 0;
+}
+
+
+EXPORT void*
+aligned_alloc(size_t align, size_t size)
+{
+    if (align == 0 || (align & (align - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return alloc_aligned(align < MIN_ALIGN ? MIN_ALIGN : align, size);
+}
+
+
+EXPORT void*
+memalign(size_t align, size_t size)
+{
+    return aligned_alloc(align, size);
+}
+
+
+EXPORT void*
+valloc(size_t size)
+{
+    return alloc_aligned((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+
+EXPORT void*
+pvalloc(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return alloc_aligned(page, (size + page - 1) & ~(page - 1));
+}
+
+
+EXPORT size_t
+malloc_usable_size(void *p)
+{
+    return p != NULL ? usable_size(p) : 0;
+}
@@ -0,0 +1,443 @@
+/****h* mem_alloc/mem_replay
+ *  NAME
+ *    mem_replay - replay a trace of allocations and measure it
+ *  SYNOPSIS
+ *    mem_replay [-l] [-t] [-s samples] file.trace
+ *    mem_replay -c ring.bin file.trace
+ *  DESCRIPTION
+ *    Replays the trace against mem_alloc, mem_free and mem_realloc, or
+ *    against malloc, free and realloc of the C library with -l, and
+ *    reports the operations per second, the latency of each kind of
+ *    operation (p50, p99, p999), the peak RSS and the fragmentation at
+ *    samples points of the trace (20 by default): the bytes asked by the
+ *    live areas against the bytes the allocator holds.  With -t every
+ *    area is filled after its allocation, outside of the measured time,
+ *    so that the RSS counts the pages really used.
+ *
+ *    With -c, a ring written by mem_trace_dump is converted into a trace:
+ *    the addresses are replaced by slots, and the frees of areas
+ *    allocated before the start of the ring are dropped.
+ ******
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include "mem.h"
+#include "trace.h"
+
+#define DEFAULT_SAMPLES 20
+
+
+struct op_times {
+    const char *name;
+    uint32_t *ns;
+    uint64_t count;
+};
+
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+
+static long
+peak_rss_kb(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+/* bytes held by the allocator, obtained from the OS */
+static size_t
+footprint(int libc)
+{
+    struct mem_stats stats;
+    if (libc)
+    {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+        struct mallinfo2 info = mallinfo2();
+        return info.arena + info.hblkhd;
+#else
+        struct mallinfo info = mallinfo();
+        return (size_t)(unsigned int)info.arena
+            + (size_t)(unsigned int)info.hblkhd;
+#endif
+    }
+    mem_stats(&stats);
+    return stats.chunk_bytes + stats.direct_bytes;
+}
+
+
+static int
+compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+
+static void
+print_times(struct op_times *t)
+{
+    if (t->count == 0)
+    {
+        return;
+    }
+    qsort(t->ns, t->count, sizeof(t->ns[0]), compare_u32);
+    printf("%-8s %10llu ops  p50 %6u ns  p99 %6u ns  p999 %6u ns\n",
+        t->name, (unsigned long long)t->count,
+        t->ns[t->count / 2], t->ns[t->count * 99 / 100],
+        t->ns[t->count * 999 / 1000]);
+}
+
+
+static int
+read_trace(const char *path, struct trace_header *header,
+    struct trace_record **records)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    if (fread(header, sizeof(*header), 1, f) != 1
+        || memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s: not a trace\n", path);
+        fclose(f);
+        return -1;
+    }
+    *records = malloc(header->count * sizeof(**records) + 1);
+    if (*records == NULL)
+    {
+        fprintf(stderr, "%s: no memory for %llu records\n", path,
+            (unsigned long long)header->count);
+        fclose(f);
+        return -1;
+    }
+    if (fread(*records, sizeof(**records), header->count, f) != header->count)
+    {
+        fprintf(stderr, "%s: truncated trace\n", path);
+        free(*records);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
+
+
+static int
+replay(const char *path, int libc, int touch, unsigned int samples)
+{
+    struct trace_header header;
+    struct trace_record *records, *r;
+    struct op_times times[4] = {
+        { NULL, NULL, 0 }, { "alloc", NULL, 0 }, { "free", NULL, 0 },
+        { "realloc", NULL, 0 }
+    };
+    void **slots;
+    size_t *sizes, size;
+    uint64_t k, every, t0, t, total = 0;
+    size_t live = 0, held;
+    long rss_before;
+    unsigned int op;
+
+    if (read_trace(path, &header, &records) != 0)
+    {
+        return 1;
+    }
+    slots = calloc(header.slots + 1, sizeof(*slots));
+    sizes = calloc(header.slots + 1, sizeof(*sizes));
+    for (op = 1; op < 4; op++)
+    {
+        times[op].ns = malloc(header.count * sizeof(uint32_t) + 1);
+    }
+    if (slots == NULL || sizes == NULL || times[TRACE_ALLOC].ns == NULL
+        || times[TRACE_FREE].ns == NULL || times[TRACE_REALLOC].ns == NULL)
+    {
+        fprintf(stderr, "%s: no memory for the replay\n", path);
+        return 1;
+    }
+    every = samples > 0 ? header.count / samples : 0;
+    if (!libc)
+    {
+        mem_init();
+    }
+    rss_before = peak_rss_kb();
+
+    printf("allocator: %s\n", libc ? "libc" : "mem");
+    printf("%12s %14s %14s %8s\n", "operation", "live bytes", "held bytes",
+        "ratio");
+    for (k = 0; k < header.count; k++)
+    {
+        r = &records[k];
+        size = (size_t)r->size;
+        if (r->slot >= header.slots || r->op < 1 || r->op > 3
+            || size != r->size)
+        {
+            fprintf(stderr, "%s: bad record %llu\n", path,
+                (unsigned long long)k);
+            return 1;
+        }
+        t0 = now_ns();
+        switch (r->op)
+        {
+        case TRACE_ALLOC:
+            slots[r->slot] = libc ? malloc(size) : mem_alloc(size);
+            break;
+        case TRACE_FREE:
+            if (libc)
+            {
+                free(slots[r->slot]);
+            }
+            else if (slots[r->slot] != NULL)
+            {
+                mem_free(slots[r->slot]);
+            }
+            break;
+        case TRACE_REALLOC:
+            slots[r->slot] = libc ? realloc(slots[r->slot], size)
+                : mem_realloc(slots[r->slot], size);
+            break;
+        }
+        t = now_ns() - t0;
+        total += t;
+        times[r->op].ns[times[r->op].count++] =
+            t > UINT32_MAX ? UINT32_MAX : (uint32_t)t;
+
+        live -= sizes[r->slot];
+        sizes[r->slot] = r->op == TRACE_FREE ? 0 : size;
+        live += sizes[r->slot];
+        if (r->op == TRACE_FREE)
+        {
+            slots[r->slot] = NULL;
+        }
+        else if (touch && slots[r->slot] != NULL)
+        {
+            memset(slots[r->slot], 0xa5, size);
+        }
+        if (every > 0 && (k + 1) % every == 0)
+        {
+            held = footprint(libc);
+            printf("%12llu %14zu %14zu %8.3f\n", (unsigned long long)k + 1,
+                live, held, live > 0 ? (double)held / (double)live : 0.0);
+        }
+    }
+
+    printf("operations: %llu in %.3f s, %.0f ops/s\n",
+        (unsigned long long)header.count, (double)total / 1e9,
+        total > 0 ? (double)header.count * 1e9 / (double)total : 0.0);
+    for (op = 1; op < 4; op++)
+    {
+        print_times(&times[op]);
+    }
+    printf("peak RSS: %ld KiB (%ld KiB before the replay)\n", peak_rss_kb(),
+        rss_before);
+
+    // a trace converted from a ring can end with live areas
+    for (k = 0; k < header.slots; k++)
+    {
+        if (slots[k] != NULL && libc)
+        {
+            free(slots[k]);
+        }
+        else if (slots[k] != NULL)
+        {
+            mem_free(slots[k]);
+        }
+    }
+    if (!libc)
+    {
+        mem_finalize();
+    }
+    for (op = 1; op < 4; op++)
+    {
+        free(times[op].ns);
+    }
+    free(sizes);
+    free(slots);
+    free(records);
+    return 0;
+}
+
+
+/* open addressing table from the addresses of a ring to slots */
+struct slot_map {
+    void **keys;
+    uint32_t *values;
+    size_t mask;
+};
+
+#define MAP_DELETED ((void*)1)
+
+static size_t
+map_find(struct slot_map *map, void *key, int insert)
+{
+    size_t i = ((uintptr_t)key >> 4) * 0x9e3779b97f4a7c15ull & map->mask;
+    size_t deleted = map->mask + 1;
+    while (map->keys[i] != NULL)
+    {
+        if (map->keys[i] == key)
+        {
+            return i;
+        }
+        if (map->keys[i] == MAP_DELETED && deleted > map->mask)
+        {
+            deleted = i;
+        }
+        i = (i + 1) & map->mask;
+    }
+    return insert && deleted <= map->mask ? deleted : i;
+}
+
+
+static int
+convert(const char *ring_path, const char *trace_path)
+{
+    struct mem_trace_event event;
+    struct slot_map map;
+    uint32_t *free_slots, free_count = 0, slots = 0, slot = 0;
+    uint64_t count = 0;
+    size_t events, size, i;
+    FILE *in, *out;
+
+    in = fopen(ring_path, "rb");
+    if (in == NULL)
+    {
+        perror(ring_path);
+        return 1;
+    }
+    fseek(in, 0, SEEK_END);
+    events = (size_t)ftell(in) / sizeof(event);
+    fseek(in, 0, SEEK_SET);
+    for (size = 16; size < 4 * events; size *= 2)
+        ;
+    map.keys = calloc(size, sizeof(*map.keys));
+    map.values = calloc(size, sizeof(*map.values));
+    map.mask = size - 1;
+    free_slots = malloc(events * sizeof(*free_slots) + 1);
+    if (map.keys == NULL || map.values == NULL || free_slots == NULL)
+    {
+        fprintf(stderr, "%s: no memory for %zu events\n", ring_path, events);
+        return 1;
+    }
+
+    out = fopen(trace_path, "wb");
+    if (out == NULL)
+    {
+        perror(trace_path);
+        return 1;
+    }
+    trace_write_header(out, 0, 0);
+    while (fread(&event, sizeof(event), 1, in) == 1)
+    {
+        if (event.op == MEM_TRACE_FREE || event.op == MEM_TRACE_REALLOC)
+        {
+            i = map_find(&map, event.op == MEM_TRACE_FREE ? event.area
+                : event.old_area, 0);
+            if (map.keys[i] == NULL)
+            {
+                if (event.op == MEM_TRACE_FREE)
+                {
+                    continue;               // allocated before the ring
+                }
+                event.op = MEM_TRACE_ALLOC;
+            }
+            else
+            {
+                map.keys[i] = MAP_DELETED;
+                slot = map.values[i];
+                if (event.op == MEM_TRACE_FREE)
+                {
+                    free_slots[free_count++] = slot;
+                    trace_write(out, TRACE_FREE, slot, 0);
+                    count++;
+                    continue;
+                }
+            }
+        }
+        if (event.op == MEM_TRACE_ALLOC)
+        {
+            slot = free_count > 0 ? free_slots[--free_count] : slots++;
+        }
+        i = map_find(&map, event.area, 1);
+        map.keys[i] = event.area;
+        map.values[i] = slot;
+        trace_write(out, event.op == MEM_TRACE_ALLOC ? TRACE_ALLOC
+            : TRACE_REALLOC, slot, event.size);
+        count++;
+    }
+    fclose(in);
+    trace_write_header(out, slots, count);
+    fclose(out);
+    free(free_slots);
+    free(map.values);
+    free(map.keys);
+    printf("%s: %llu records, %u slots\n", trace_path,
+        (unsigned long long)count, slots);
+    return 0;
+}
+
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: mem_replay [-l] [-t] [-s samples] file.trace\n"
+        "       mem_replay -c ring.bin file.trace\n");
+    exit(2);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int c, libc = 0, touch = 0;
+    unsigned int samples = DEFAULT_SAMPLES;
+    const char *ring = NULL;
+    while ((c = getopt(argc, argv, "lts:c:")) != -1)
+    {
+        switch (c)
+        {
+        case 'l':
+            libc = 1;
+            break;
+        case 't':
+            touch = 1;
+            break;
+        case 's':
+            samples = (unsigned int)atoi(optarg);
+            break;
+        case 'c':
+            ring = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage();
+    }
+    if (ring != NULL)
+    {
+        return convert(ring, argv[optind]);
+    }
+    return replay(argv[optind], libc, touch, samples);
+}
@@ -4,8 +4,20 @@
 #include <sys/time.h>
 #include <sys/timeb.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "mem.h"
+#include "trace.h"
+
+#if MEM_ALLOC_THREADS
+#include <pthread.h>
+#endif
+
+#if MEM_ALLOC_HARDEN || MEM_ALLOC_THREADS
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 
 // constants for random test
@@ -13,6 +25,39 @@
 #define NUMBER_OF_ALLOCATIONS 10000
 #define MAXIMUM_ALLOC_SIZE 500000
 
+// small items of test_lazy, enough to split the biggest free item
+#define LAZY_ITEMS 512
+
+// constants for benchmarks
+#define BENCH_FREE_BLOCKS 4096
+#define BENCH_FREE_ROUNDS 50
+#define BENCH_FREE_MAX_LOG 18
+#define BENCH_SAME_BLOCKS 100000
+#define BENCH_SAME_SIZE 100
+#define BENCH_SAME_STEPS 10
+#define BENCH_MT_THREADS 8
+#define BENCH_MT_PAIRS 1000000
+#define BENCH_MT_SLOTS 64
+#define BENCH_MT_MAX_SIZE 512
+#define BENCH_BATCH_OPS 2000000
+#define BENCH_BATCH_MAX 1024
+#define BENCH_LAZY_ROUNDS 200000
+#define BENCH_LAZY_ITEMS 8
+#define BENCH_LAZY_MAX 32
+
+// constants for the benchmark suite of make bench
+#define SUITE_OPS 1000000
+#define SUITE_LIVE 1024
+#define SUITE_CHURN_SIZE 64
+#define SUITE_MAX_SMALL 1024
+#define SUITE_BOUNDARY_MAX 65536
+#define SUITE_ORDER_BLOCKS 10000
+#define SUITE_ORDER_ROUNDS 20
+#define SUITE_STORM_ROUNDS 200
+#define SUITE_STORM_BIG (1024 * 1024)
+#define SUITE_STORM_SMALL 2000
+#define SUITE_MIX_OPS 200000
+
 
 void
 test_1()
@@ -107,6 +152,77 @@ test_unsplittable()
 }
 
 
+void
+test_heaps()
+{
+    struct mem_heap *h1, *h2;
+    void *a, *b, *c;
+    unsigned int i;
+    h1 = mem_heap_create();
+    h2 = mem_heap_create();
+    a = mem_heap_alloc(h1, 100);
+    b = mem_heap_alloc(h2, 100);
+    memset(b, 0, 100);
+    mem_heap_free(h1, a);
+    for (i = 0; i < 1000; i++)
+    {
+        c = mem_heap_alloc(h2, i * 10);     // not freed, destroyed with h2
+        memset(c, 0, i * 10);
+    }
+    mem_heap_destroy(h2);
+    a = mem_heap_alloc(h1, 3000);
+    mem_heap_free(h1, a);
+    mem_heap_destroy(h1);
+}
+
+
+void
+test_trim()
+{
+    struct mem_heap *h;
+    void *ptrs[100];
+    unsigned int i;
+    h = mem_heap_create();
+    mem_heap_set_retain(h, 0, 0);       // release every free chunk
+    for (i = 0; i < 100; i++)
+    {
+        ptrs[0] = mem_heap_alloc(h, 1000000);
+        mem_heap_free(h, ptrs[0]);
+    }
+    mem_heap_set_retain(h, 1000000, 4000000);
+    for (i = 0; i < 100; i++)
+    {
+        ptrs[i] = mem_heap_alloc(h, i * 5000);
+    }
+    for (i = 0; i < 100; i++)
+    {
+        mem_heap_free(h, ptrs[i]);
+    }
+    mem_heap_trim(h);
+    mem_heap_destroy(h);
+}
+
+
+void
+test_growth()
+{
+    struct mem_heap *h;
+    unsigned int i;
+    h = mem_heap_create();
+    mem_heap_set_growth(h, 0, 20);      // chunks as small as possible
+    for (i = 0; i < 200; i++)
+    {
+        mem_heap_alloc(h, 24);
+    }
+    mem_heap_set_growth(h, 4096, 0);    // at least the size of the heap
+    for (i = 0; i < 2000; i++)
+    {
+        mem_heap_alloc(h, 24 + i);
+    }
+    mem_heap_destroy(h);
+}
+
+
 void
 fill_mem(unsigned char *buffer, unsigned int size)
 {
@@ -144,138 +260,1455 @@ check_sum(unsigned char *buffer, unsigned int size)
 
 
 void
-print_area(unsigned char *buffer, unsigned int size)
+test_realloc()
 {
-    int i;
-    for (i = 0; i < size; i++)
+    struct mem_heap *h;
+    struct mem_realloc_stats stats;
+    unsigned char *a, *b;
+    unsigned int i, x;
+    h = mem_heap_create();
+    a = mem_heap_realloc(h, NULL, 16);
+    for (x = 16; x < 100000; x = x * 3 / 2)     // grow
     {
-        if (i > 0)
+        fill_mem(a, 16);
+        a = mem_heap_realloc(h, a, x);
+        check_sum(a, 16);
+    }
+    while (x > 24)                              // shrink, to 16 or more
+    {
+        x = x * 2 / 3;
+        fill_mem(a, 16);
+        b = mem_heap_realloc(h, a, x);
+        check_sum(b, 16);
+        if (b != a)
         {
-            printf(" ");
+            printf("realloc: shrinking moved %p to %p\n", a, b);
+            exit(1);
         }
-        printf("%02x", buffer[i]);
     }
-    printf("\n");
+    mem_heap_free(h, a);
+    for (i = 0; i < 1000; i++)                  // moves when blocked
+    {
+        a = mem_heap_alloc(h, 40);
+        b = mem_heap_alloc(h, 40);
+        fill_mem(a, 40);
+        a = mem_heap_realloc(h, a, 400);
+        check_sum(a, 40);
+        mem_heap_free(h, b);
+    }
+    mem_heap_realloc_stats(h, &stats);
+    printf("realloc: %lu calls, %lu in place (%lu grown, %lu shrunk), "
+        "%lu moved\n", stats.calls, stats.in_place, stats.grown,
+        stats.shrunk, stats.moved);
+    mem_heap_destroy(h);
 }
 
 
 void
-test_random()
+test_trace()
 {
-    unsigned int count, i, j, sz, t;
-    void *array[ARRAY_SIZE];
-    unsigned int sizes[ARRAY_SIZE];
-    FILE *f = fopen("out", "w");
+    struct mem_trace_event events[8];
+    void *a, *b;
+    unsigned int count;
+    mem_trace_enable(1);
+    a = mem_alloc(100);
+    b = mem_realloc(a, 1000);
+    mem_free(b);
+    mem_trace_enable(0);
+    mem_free(mem_alloc(100));                   // not recorded
+    count = mem_trace_read(events, 8);
+    if (count != 3 || events[0].op != MEM_TRACE_ALLOC
+        || events[0].area != a || events[0].size != 100
+        || events[1].op != MEM_TRACE_REALLOC || events[1].old_area != a
+        || events[1].area != b || events[2].op != MEM_TRACE_FREE
+        || events[2].area != b || events[1].cls <= events[0].cls
+        || events[1].time < events[0].time)
+    {
+        printf("trace: wrong events (%u)\n", count);
+        exit(1);
+    }
+}
 
-//    struct timespec ts; 
-//    clock_gettime(CLOCK_REALTIME, &ts); 
-//    t = (unsigned int)(ts.tv_nsec + ts.tv_sec * 1000000000);
-  
-//    struct timeval tv;
-//    gettimeofday(&tv, NULL);
-//    t = (unsigned int)(1000000 * tv.tv_sec + tv.tv_usec);
 
-//    t = time(0);
-    
-    struct timeb tb;
-    ftime(&tb);
-    t = (unsigned int)(1000000 * tb.time + tb.millitm);
+void
+test_stats()
+{
+    struct mem_heap *h;
+    struct mem_stats before, after;
+    void *a[100];
+    unsigned int i;
+    h = mem_heap_create();
+    mem_heap_stats(h, &before);
+    for (i = 0; i < 100; i++)
+    {
+        a[i] = mem_heap_alloc(h, 100);
+    }
+    mem_heap_stats(h, &after);
+    if (after.requested - before.requested != 100 * 100
+        || after.handed_out - after.requested < before.handed_out
+            - before.requested
+        || after.allocations - before.allocations != 100
+        || after.used_bytes - before.used_bytes < 100 * 108
+        || after.splits <= before.splits
+        || after.chunks < 1 || after.largest_free > after.free_bytes)
+    {
+        printf("stats: wrong figures after alloc\n");
+        exit(1);
+    }
+    for (i = 0; i < 100; i++)
+    {
+        mem_heap_free(h, a[i]);
+    }
+    mem_heap_stats(h, &after);
+    if (after.used_bytes != before.used_bytes
+        || after.free_bytes != before.free_bytes
+        || after.merges <= before.merges)
+    {
+        printf("stats: wrong figures after free\n");
+        exit(1);
+    }
+    printf("stats: %lu chunks, %lu bytes, %lu splits, %lu merges\n",
+        after.chunks, (unsigned long)after.chunk_bytes, after.splits,
+        after.merges);
+    mem_heap_destroy(h);
+}
 
-    srand(t);
 
-    // initialize the array
-    for (i = 0; i < ARRAY_SIZE; i++)
+void
+test_aligned()
+{
+    struct mem_heap *h;
+    struct mem_stats before, after;
+    unsigned char *a[64];
+    size_t align;
+    unsigned int i, x;
+    h = mem_heap_create();
+    mem_heap_stats(h, &before);
+    for (align = 16; align <= 4096; align *= 2)
     {
-        array[i] = NULL;
+        for (i = 0; i < 64; i++)
+        {
+            x = (i * 37 + 1) % 600 + (i % 8 == 0 ? 5000 : 0);
+            a[i] = mem_heap_alloc_aligned(h, align, x);
+            if ((uintptr_t)a[i] % align != 0)
+            {
+                printf("aligned: %p not aligned on %u\n", a[i],
+                    (unsigned int)align);
+                exit(1);
+            }
+            memset(a[i], (int)i, x);
+        }
+        for (i = 0; i < 64; i++)
+        {
+            mem_heap_free(h, a[i]);
+        }
+    }
+    mem_heap_stats(h, &after);
+    if (after.used_bytes != before.used_bytes
+        || mem_heap_alloc_aligned(h, 24, 10) != NULL)
+    {
+        printf("aligned: wrong figures after free\n");
+        exit(1);
+    }
+    mem_heap_destroy(h);
+    a[0] = mem_alloc_aligned(64, 100);
+    if ((uintptr_t)a[0] % 64 != 0)
+    {
+        printf("aligned: %p not aligned on 64\n", a[0]);
+        exit(1);
     }
+    mem_free(a[0]);
+}
 
-    count = 0;
-    j = 0;
-    fprintf(f, "\nvoid\ntest_random_gen()\n{\n");
-    while (count < NUMBER_OF_ALLOCATIONS)
+
+void
+test_slabs()
+{
+    struct mem_heap *h;
+    struct mem_stats stats;
+    unsigned char *a[1000];
+    unsigned int i, j, x;
+    h = mem_heap_create();
+    for (i = 0; i < 1000; i++)
     {
-        i = (unsigned int)(rand() % ARRAY_SIZE);
-        if (array[i] == NULL)
+        x = i % 65;
+        a[i] = mem_heap_alloc(h, x);
+        memset(a[i], (int)(i & 0xff), x);
+        if (mem_heap_usable_size(h, a[i]) < x)
         {
-            sz = (unsigned int)((rand() % MAXIMUM_ALLOC_SIZE) + 1);
-            fprintf(f, "    array[%d] = mem_alloc(%d);\n", i, sz);
-            array[i] = mem_alloc(sz);
-            sizes[i] = sz;
-            fill_mem((unsigned char*)array[i], sizes[i]);
-            count++;
+            printf("slabs: slot of %u bytes too small\n", x);
+            exit(1);
         }
-        else
+    }
+    for (i = 0; i < 1000; i += 10)
+    {
+        a[i] = mem_heap_realloc(h, a[i], i % 65 + 100);     // to an item
+    }
+    mem_heap_stats(h, &stats);
+    if (stats.slabs > 0 && stats.slots != 900)     // unless built without
+    {
+        printf("slabs: %lu slots in use instead of 900\n", stats.slots);
+        exit(1);
+    }
+    for (i = 0; i < 1000; i++)
+    {
+        for (j = 0; j < i % 65; j++)
         {
-            fprintf(f, "    mem_free(array[%d]);\n", i);
-            check_sum(array[i], sizes[i]);
-            mem_free(array[i]);
-            array[i] = NULL;
+            if (a[i][j] != (i & 0xff))
+            {
+                printf("slabs: area %u overwritten\n", i);
+                exit(1);
+            }
         }
-        if (array[j] != NULL)
+        mem_heap_free(h, a[i]);
+    }
+    mem_heap_stats(h, &stats);
+    if (stats.slots != 0)
+    {
+        printf("slabs: %lu slots in use after free\n", stats.slots);
+        exit(1);
+    }
+    mem_heap_trim(h);
+    mem_heap_stats(h, &stats);
+    if (stats.slabs != 0)
+    {
+        printf("slabs: %lu slabs left after trim\n", stats.slabs);
+        exit(1);
+    }
+    mem_heap_destroy(h);
+}
+
+
+void
+test_free_sized()
+{
+    struct mem_heap *h;
+    struct mem_stats before, after;
+    void *a[300];
+    unsigned int sizes[300];
+    unsigned int round, i;
+    h = mem_heap_create();
+    for (round = 0; round < 2; round++)     // the first round adds slabs
+    {
+        mem_heap_stats(h, &before);
+        for (i = 0; i < 300; i++)
         {
-            fprintf(f, "[%03d]: fill_mem sz=%d\n", j, sizes[j]);
-            fill_mem((unsigned char*)array[j], sizes[j]);
+            sizes[i] = i * 7;
+            a[i] = i % 50 == 1 ? mem_heap_alloc_aligned(h, 256, sizes[i])
+                : mem_heap_alloc(h, sizes[i]);
+            if (i % 30 == 0)
+            {
+                sizes[i] = (i * 37) % 1000;
+                a[i] = mem_heap_realloc(h, a[i], sizes[i]);
+            }
         }
-        j = (j + 1) % ARRAY_SIZE;
+        for (i = 0; i < 300; i++)
+        {
+            mem_heap_free_sized(h, a[i], sizes[i]);
+        }
+        mem_heap_stats(h, &after);
     }
+    if (after.used_bytes != before.used_bytes || after.slots != 0)
+    {
+        printf("free_sized: wrong figures after free\n");
+        exit(1);
+    }
+    mem_heap_destroy(h);
+    mem_free_sized(mem_alloc(1000), 1000);
+    mem_free_sized(mem_alloc(10), 10);
+}
 
-    // free remaining
-    for (i = 0; i < ARRAY_SIZE; i++)
+
+void
+test_batch()
+{
+    static const unsigned int sizes[] = { 10, 64, 100, 1000, 5000 };
+    static const unsigned int counts[] = { 1, 64, 300, 1024 };
+    struct mem_heap *h;
+    struct mem_stats before, after;
+    static void *a[1024];
+    void *tmp;
+    unsigned int s, c, round, i;
+    h = mem_heap_create();
+    for (round = 0; round < 2; round++)     // the first round adds chunks
     {
-        if (array[i] != NULL)
+        mem_heap_stats(h, &before);
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
         {
-            fprintf(f, "    mem_free(array[%d]);\n", i);
-            check_sum(array[i], sizes[i]);
-            mem_free(array[i]);
+            for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+            {
+                mem_heap_alloc_batch(h, sizes[s], counts[c], a);
+                for (i = 0; i < counts[c]; i++)
+                {
+                    memset(a[i], (int)i, sizes[s]);
+                }
+                for (i = 0; i < counts[c]; i++)
+                {
+                    if (((unsigned char*)a[i])[sizes[s] - 1]
+                        != (unsigned char)i)
+                    {
+                        printf("batch: overlapping areas\n");
+                        exit(1);
+                    }
+                }
+                for (i = 0; i < counts[c] / 2; i++)   // not sorted
+                {
+                    tmp = a[i];
+                    a[i] = a[counts[c] - 1 - i];
+                    a[counts[c] - 1 - i] = tmp;
+                }
+                mem_heap_free_batch(h, a, counts[c]);
+            }
         }
+        mem_heap_stats(h, &after);
     }
-    fprintf(f, "}\n");
-    fclose(f);
+    if (after.used_bytes != before.used_bytes || after.slots != 0
+        || !mem_heap_check(h))
+    {
+        printf("batch: wrong figures after free\n");
+        exit(1);
+    }
+    mem_heap_destroy(h);
+    mem_alloc_batch(200, 100, a);
+    mem_free_batch(a, 100);
 }
 
 
 void
-test_random_gen1()
+test_lazy()
 {
-    void *array[4];
-
-    array[2] = mem_alloc(721);
-    mem_free(array[2]);
-    array[1] = mem_alloc(501);
-    array[0] = mem_alloc(12);
-    array[2] = mem_alloc(307);
-    mem_free(array[0]);
-    mem_free(array[1]);
-    array[1] = mem_alloc(438);
-    mem_free(array[2]);
+    struct mem_heap *h;
+    struct mem_stats start, before, after;
+    void *a[LAZY_ITEMS], *big;
+    unsigned int round, i, n;
+    size_t largest;
+    h = mem_heap_create();
+    mem_heap_stats(h, &start);
+    mem_heap_set_lazy(h, 16);
+    for (round = 0; round < 10; round++)    // only the first round splits
+    {
+        for (i = 0; i < 8; i++)
+        {
+            a[i] = mem_heap_alloc(h, 1000);
+            memset(a[i], (int)i, 1000);
+        }
+        if (round == 0)
+        {
+            mem_heap_stats(h, &before);
+        }
+        for (i = 0; i < 8; i++)
+        {
+            mem_heap_free(h, a[i]);
+        }
+    }
+    mem_heap_stats(h, &after);
+    if (after.splits != before.splits || after.merges != before.merges)
+    {
+        printf("lazy: the same size was split or merged again\n");
+        exit(1);
+    }
+    // the biggest free item once all is merged, then 40 small items or
+    // more until it is split, freed from the last one so that it stays
+    // split: more than 16, some are merged
+    mem_heap_trim(h);
+    mem_heap_stats(h, &before);
+    largest = before.largest_free;
+    for (n = 0; n < LAZY_ITEMS && (n < 40 || before.largest_free >= largest);
+        n++)
+    {
+        a[n] = mem_heap_alloc(h, 300);
+        mem_heap_stats(h, &before);
+    }
+    while (n > 0)
+    {
+        mem_heap_free(h, a[--n]);
+    }
+    mem_heap_stats(h, &before);
+    if (before.largest_free >= largest)
+    {
+        printf("lazy: the biggest free item was not split\n");
+        exit(1);
+    }
+    big = mem_heap_alloc(h, largest - 64);  // merges the unmerged items
+    mem_heap_stats(h, &after);
+    if (after.chunks != before.chunks || after.merges == before.merges)
+    {
+        printf("lazy: the unmerged items were not merged\n");
+        exit(1);
+    }
+    mem_heap_free(h, big);
+    mem_heap_set_lazy(h, 0);
+    mem_heap_stats(h, &after);
+    if (after.used_bytes != start.used_bytes)
+    {
+        printf("lazy: wrong figures after free\n");
+        exit(1);
+    }
+    mem_heap_destroy(h);
 }
 
 
 void
-test_random_gen2()
+test_huge()
 {
-    void *array[25];
-    array[9] = mem_alloc(97);
-    array[21] = mem_alloc(76);
-    array[22] = mem_alloc(98);
-    mem_free(array[22]);
-    array[6] = mem_alloc(77);
-    array[18] = mem_alloc(91);
-    mem_free(array[9]);
+    struct mem_stats before, stats;
+    unsigned char *a, *b;
+    size_t x = (size_t)20 * 1024 * 1024;
+    mem_stats(&before);
+    a = mem_alloc(x);
+    mem_stats(&stats);
+    if (a == NULL || stats.direct != before.direct + 1
+        || stats.chunks != before.chunks || mem_usable_size(a) < x)
+    {
+        printf("huge: the area is not a direct area\n");
+        exit(1);
+    }
+    a[0] = 1;
+    a[x - 1] = 2;
+    b = mem_realloc(a, 2 * x);                  // moves to a new mapping
+    if (b == NULL || b[0] != 1 || b[x - 1] != 2)
+    {
+        printf("huge: realloc lost the contents\n");
+        exit(1);
+    }
+    a = mem_realloc(b, 1000);                   // back into the heap
+    mem_stats(&stats);
+    if (a == NULL || a[0] != 1 || stats.direct != before.direct
+        || stats.direct_bytes != before.direct_bytes)
+    {
+        printf("huge: the direct area was not released\n");
+        exit(1);
+    }
+    mem_free(a);
+    a = mem_alloc_aligned((size_t)32 * 1024 * 1024, 100);
+    if (a == NULL || ((uintptr_t)a & (32 * 1024 * 1024 - 1)) != 0)
+    {
+        printf("huge: the direct area is not aligned\n");
+        exit(1);
+    }
+    mem_free(a);
+#if SIZE_MAX > 0xffffffff
+    x = (size_t)5 * 1024 * 1024 * 1024;         // more than 32 bits
+    a = mem_alloc(x);
+    if (a != NULL)                              // the OS can refuse it
+    {
+        a[0] = 1;
+        a[x - 1] = 2;
+        mem_free(a);
+    }
+#endif
+    a = mem_alloc(100);
+    if (mem_alloc(SIZE_MAX) != NULL || mem_alloc(SIZE_MAX / 2 + 1) != NULL
+        || mem_realloc(a, SIZE_MAX) != NULL)
+    {
+        printf("huge: an impossible size did not fail\n");
+        exit(1);
+    }
+    mem_free(a);
 }
 
-void
-test_random_gen3()
+
+struct walked {
+    void *areas[8];
+    unsigned int found;
+};
+
+
+/* counts the areas of test_check reported in use by mem_heap_walk */
+static void
+count_walked(void *area, size_t bytes, int used, void *arg)
 {
-    void *array[25];
-    array[18] = mem_alloc(2493);
-    mem_free(array[18]);
+    struct walked *w = arg;
+    unsigned int i;
+    for (i = 0; i < 8; i++)
+    {
+        if (area == w->areas[i] && used && bytes >= 1000)
+        {
+            w->found++;
+        }
+    }
 }
 
-int
-main(int argc, char **argv)
+
+void
+test_check()
 {
-    mem_init();
+    struct mem_heap *h;
+    struct walked w;
+    void **a = w.areas;
+    unsigned int i;
+    h = mem_heap_create();
+    for (i = 0; i < 8; i++)
+    {
+        a[i] = mem_heap_alloc(h, 1000);
+    }
+    mem_heap_free(h, a[2]);
+    mem_heap_free(h, a[5]);
+    a[2] = a[5] = NULL;
+    if (!mem_heap_check(h))
+    {
+        printf("check: a sane heap did not pass\n");
+        exit(1);
+    }
+    w.found = 0;
+    mem_heap_walk(h, count_walked, &w);
+    if (w.found != 6)
+    {
+        printf("check: the walk did not find the areas\n");
+        exit(1);
+    }
+    ((uintptr_t*)a[0])[-1] ^= 4;            // in_use bit of the header
+    fprintf(stderr, "test_check: an error is expected:\n");
+    if (mem_heap_check(h))
+    {
+        printf("check: a broken header was not found\n");
+        exit(1);
+    }
+    ((uintptr_t*)a[0])[-1] ^= 4;
+    if (!mem_check() || !mem_heap_check(h))
+    {
+        printf("check: the heap did not pass again\n");
+        exit(1);
+    }
+    mem_heap_destroy(h);
+}
+
+
+void
+test_heap_of()
+{
+    struct mem_heap *h1, *h2, *d;
+    void *a, *b, *c, *e;
+    int local;
+#if MEM_ALLOC_THREADS
+    struct mem_stats before, after;
+    void *cached[32];
+    unsigned int i;
+#endif
+    h1 = mem_heap_create();
+    h2 = mem_heap_create();
+    a = mem_heap_alloc(h1, 1000);
+    b = mem_heap_alloc(h2, 1000);
+    c = mem_heap_alloc(h1, 20000000);       // a direct area
+    e = mem_alloc(24);
+    d = mem_heap_of(e);
+    if (mem_heap_of(a) != h1 || mem_heap_of(b) != h2 || mem_heap_of(c) != h1
+        || mem_heap_of((char*)c + 19999999) != h1 || mem_heap_of(h2) != h2
+        || d == NULL || d == h1 || d == h2 || mem_heap_of(&local) != NULL)
+    {
+        printf("heap_of: wrong heap\n");
+        exit(1);
+    }
+    mem_heap_free(mem_heap_of(c), c);
+    mem_heap_destroy(h2);
+    if (mem_heap_of(b) != NULL || !mem_heap_check(h1))
+    {
+        printf("heap_of: a destroyed heap is still found\n");
+        exit(1);
+    }
+    mem_heap_free(mem_heap_of(a), a);
+#if MEM_ALLOC_THREADS
+    for (i = 0; i < 32; i++)                // the list of the cache is empty
+    {
+        cached[i] = mem_alloc(24);
+    }
+    mem_heap_stats(d, &before);
+    mem_heap_free(d, e);                    // into the cache, still used
+    mem_heap_stats(d, &after);
+    if (after.used_bytes != before.used_bytes)
+    {
+        printf("heap_of: the default heap bypassed the cache\n");
+        exit(1);
+    }
+    mem_free_batch(cached, 32);
+#else
+    mem_heap_free(d, e);
+#endif
+    e = mem_alloc(24);
+    e = mem_heap_realloc(d, e, 30);
+    mem_heap_free_sized(d, e, 30);
+    e = mem_heap_alloc(d, 16);
+    mem_heap_free(d, e);
+    mem_heap_destroy(h1);
+}
+
+
+#if MEM_ALLOC_THREADS
+
+static volatile int fork_stop;
+
+/* keeps the lock of the heap busy while the main thread forks */
+void*
+fork_thread(void *arg)
+{
+    struct mem_heap *h = arg;
+    void *a;
+    while (!fork_stop)
+    {
+        a = mem_heap_alloc(h, 3000);
+        mem_heap_free(h, a);
+    }
+    return NULL;
+}
+
+
+void
+test_fork()
+{
+    struct mem_heap *h = mem_heap_create();
+    pthread_t thread;
+    pid_t pid;
+    int i, status;
+    fork_stop = 0;
+    pthread_create(&thread, NULL, fork_thread, h);
+    for (i = 0; i < 100; i++)
+    {
+        pid = fork();
+        if (pid == 0)
+        {
+            alarm(10);                  // a lock left taken hangs the child
+            mem_heap_free(h, mem_heap_alloc(h, 3000));
+            mem_free(mem_alloc(3000));
+            _exit(0);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) != pid
+            || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            printf("fork: the child could not allocate from the heap\n");
+            exit(1);
+        }
+    }
+    fork_stop = 1;
+    pthread_join(thread, NULL);
+    mem_heap_destroy(h);
+}
+
+#endif /* MEM_ALLOC_THREADS */
+
+
+#if MEM_ALLOC_HARDEN
+
+void
+harden_double_free()
+{
+    void *a = mem_alloc(100);
+    mem_free(a);
+    mem_free(a);
+}
+
+
+void
+harden_overflow()
+{
+    unsigned char *a = mem_alloc(100);
+    a[100] = 0;
+    mem_free(a);
+}
+
+
+void
+harden_foreign()
+{
+    static uintptr_t buffer[8] = { 0, 4 };
+    mem_free(&buffer[2]);
+}
+
+
+void
+harden_free_sized()
+{
+    struct mem_heap *h = mem_heap_create();
+    void *a = mem_heap_alloc(h, 1000);
+    mem_heap_free_sized(h, a, 100000);
+}
+
+
+/* a small area of the default heap goes through the cache with threads */
+void
+harden_free_sized_default()
+{
+    void *a = mem_alloc(100);
+    mem_free_sized(a, 100000);
+}
+
+
+/* runs f in a child process, which must be aborted */
+void
+expect_abort(void (*f)(void), const char *name)
+{
+    pid_t pid;
+    int status;
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0)
+    {
+        f();
+        _exit(0);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid
+        || !WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT)
+    {
+        printf("harden: %s was not stopped\n", name);
+        exit(1);
+    }
+}
+
+
+void
+test_harden()
+{
+    unsigned char *a;
+    a = mem_alloc(100);
+    if (a[50] != 0xcd || mem_usable_size(a) != 100)
+    {
+        printf("harden: area not filled or wrong usable size\n");
+        exit(1);
+    }
+    memset(a, 1, 100);
+    a = mem_realloc(a, 3000);
+    if (a[99] != 1 || a[100] != 0xcd || a[2999] != 0xcd)
+    {
+        printf("harden: realloc did not keep or fill the area\n");
+        exit(1);
+    }
+    mem_free(a);
+    fprintf(stderr, "test_harden: 5 errors are expected:\n");
+    expect_abort(harden_double_free, "double free");
+    expect_abort(harden_overflow, "overflow");
+    expect_abort(harden_foreign, "foreign pointer");
+    expect_abort(harden_free_sized, "free with a bigger size");
+    expect_abort(harden_free_sized_default,
+                 "free of the default heap with a bigger size");
+}
+
+#endif /* MEM_ALLOC_HARDEN */
+
+
+void
+print_area(unsigned char *buffer, unsigned int size)
+{
+    int i;
+    for (i = 0; i < size; i++)
+    {
+        if (i > 0)
+        {
+            printf(" ");
+        }
+        printf("%02x", buffer[i]);
+    }
+    printf("\n");
+}
+
+
+void
+test_random()
+{
+    unsigned int count, i, j, sz, t;
+    void *array[ARRAY_SIZE];
+    unsigned int sizes[ARRAY_SIZE];
+    uint64_t records = 0;
+    FILE *f = fopen("out", "w");
+    FILE *trace = fopen("out.trace", "wb");     // for mem_replay
+
+//    struct timespec ts; 
+//    clock_gettime(CLOCK_REALTIME, &ts); 
+//    t = (unsigned int)(ts.tv_nsec + ts.tv_sec * 1000000000);
+  
+//    struct timeval tv;
+//    gettimeofday(&tv, NULL);
+//    t = (unsigned int)(1000000 * tv.tv_sec + tv.tv_usec);
+
+//    t = time(0);
+    
+    struct timeb tb;
+    ftime(&tb);
+    t = (unsigned int)(1000000 * tb.time + tb.millitm);
+
+    srand(t);
+
+    // initialize the array
+    for (i = 0; i < ARRAY_SIZE; i++)
+    {
+        array[i] = NULL;
+    }
+
+    count = 0;
+    j = 0;
+    trace_write_header(trace, ARRAY_SIZE, 0);
+    fprintf(f, "\nvoid\ntest_random_gen()\n{\n");
+    while (count < NUMBER_OF_ALLOCATIONS)
+    {
+        i = (unsigned int)(rand() % ARRAY_SIZE);
+        if (array[i] == NULL)
+        {
+            sz = (unsigned int)((rand() % MAXIMUM_ALLOC_SIZE) + 1);
+            fprintf(f, "    array[%d] = mem_alloc(%d);\n", i, sz);
+            trace_write(trace, TRACE_ALLOC, i, sz);
+            records++;
+            array[i] = mem_alloc(sz);
+            sizes[i] = sz;
+            fill_mem((unsigned char*)array[i], sizes[i]);
+            count++;
+        }
+        else
+        {
+            fprintf(f, "    mem_free(array[%d]);\n", i);
+            trace_write(trace, TRACE_FREE, i, 0);
+            records++;
+            check_sum(array[i], sizes[i]);
+            mem_free(array[i]);
+            array[i] = NULL;
+        }
+        if (array[j] != NULL)
+        {
+            fprintf(f, "[%03d]: fill_mem sz=%d\n", j, sizes[j]);
+            fill_mem((unsigned char*)array[j], sizes[j]);
+        }
+        j = (j + 1) % ARRAY_SIZE;
+    }
+
+    // free remaining
+    for (i = 0; i < ARRAY_SIZE; i++)
+    {
+        if (array[i] != NULL)
+        {
+            fprintf(f, "    mem_free(array[%d]);\n", i);
+            trace_write(trace, TRACE_FREE, i, 0);
+            records++;
+            check_sum(array[i], sizes[i]);
+            mem_free(array[i]);
+        }
+    }
+    if (!mem_check())
+    {
+        printf("random: the heap is not consistent\n");
+        exit(1);
+    }
+    fprintf(f, "}\n");
+    fclose(f);
+    trace_write_header(trace, ARRAY_SIZE, records);
+    fclose(trace);
+}
+
+
+void
+test_random_gen1()
+{
+    void *array[4];
+
+    array[2] = mem_alloc(721);
+    mem_free(array[2]);
+    array[1] = mem_alloc(501);
+    array[0] = mem_alloc(12);
+    array[2] = mem_alloc(307);
+    mem_free(array[0]);
+    mem_free(array[1]);
+    array[1] = mem_alloc(438);
+    mem_free(array[2]);
+}
+
+
+void
+test_random_gen2()
+{
+    void *array[25];
+    array[9] = mem_alloc(97);
+    array[21] = mem_alloc(76);
+    array[22] = mem_alloc(98);
+    mem_free(array[22]);
+    array[6] = mem_alloc(77);
+    array[18] = mem_alloc(91);
+    mem_free(array[9]);
+}
+
+void
+test_random_gen3()
+{
+    void *array[25];
+    array[18] = mem_alloc(2493);
+    mem_free(array[18]);
+}
+
+double
+bench_seconds(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+/* shuffle the pointers so that they are freed in a random order */
+void
+shuffle(void **ptrs, unsigned int n)
+{
+    unsigned int i, j;
+    void *tmp;
+    for (i = n - 1; i > 0; i--)
+    {
+        j = (unsigned int)rand() % (i + 1);
+        tmp = ptrs[i];
+        ptrs[i] = ptrs[j];
+        ptrs[j] = tmp;
+    }
+}
+
+
+/* free-heavy workload: blocks of sizes spread over many classes are
+ * allocated and then freed in a random order, only the frees are timed
+ */
+void
+bench_free()
+{
+    static void *ptrs[BENCH_FREE_BLOCKS];
+    unsigned int round, i, sz;
+    double t_free;
+    clock_t start;
+
+    srand(1);
+    t_free = 0;
+    for (round = 0; round < BENCH_FREE_ROUNDS; round++)
+    {
+        for (i = 0; i < BENCH_FREE_BLOCKS; i++)
+        {
+            sz = 1u << (rand() % BENCH_FREE_MAX_LOG);
+            sz += (unsigned int)rand() % sz;
+            ptrs[i] = mem_alloc(sz);
+        }
+        shuffle(ptrs, BENCH_FREE_BLOCKS);
+        start = clock();
+        for (i = 0; i < BENCH_FREE_BLOCKS; i++)
+        {
+            mem_free(ptrs[i]);
+        }
+        t_free += bench_seconds(start);
+    }
+    printf("bench_free: %u frees, %.1f ns/free\n",
+        BENCH_FREE_BLOCKS * BENCH_FREE_ROUNDS,
+        t_free * 1e9 / (BENCH_FREE_BLOCKS * BENCH_FREE_ROUNDS));
+}
+
+
+/* free 100k blocks of the same size in a random order, the latency is
+ * printed for each tenth of the frees and should stay flat
+ */
+void
+bench_free_same()
+{
+    static void *ptrs[BENCH_SAME_BLOCKS];
+    unsigned int i, step, per_step;
+    clock_t start;
+
+    srand(1);
+    for (i = 0; i < BENCH_SAME_BLOCKS; i++)
+    {
+        ptrs[i] = mem_alloc(BENCH_SAME_SIZE);
+    }
+    shuffle(ptrs, BENCH_SAME_BLOCKS);
+    per_step = BENCH_SAME_BLOCKS / BENCH_SAME_STEPS;
+    for (step = 0; step < BENCH_SAME_STEPS; step++)
+    {
+        start = clock();
+        for (i = step * per_step; i < (step + 1) * per_step; i++)
+        {
+            mem_free(ptrs[i]);
+        }
+        printf("bench_free_same: frees %6u-%6u %.1f ns/free\n",
+            step * per_step, (step + 1) * per_step - 1,
+            bench_seconds(start) * 1e9 / per_step);
+    }
+}
+
+
+/* groups of areas of the same size allocated and freed one by one, and
+ * then by mem_heap_alloc_batch and mem_heap_free_batch, the allocations
+ * and the frees timed apart: the batch saves the lock and the search of
+ * the classes for each allocation, and for the frees the lock and the
+ * free lists of the buddies merged within the batch.  The 32 bytes areas
+ * are slots, which are not merged
+ */
+void
+bench_batch()
+{
+    static const unsigned int sizes[] = { 32, 100, 1000 };
+    static void *ptrs[BENCH_BATCH_MAX];
+    unsigned int s, n, round, rounds, i, mode;
+    struct mem_heap *h;
+    double t_alloc[2], t_free[2], per_area;
+    clock_t start;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        for (n = 64; n <= BENCH_BATCH_MAX; n *= 4)
+        {
+            rounds = BENCH_BATCH_OPS / n;
+            for (mode = 0; mode < 2; mode++)    // one by one, then batches
+            {
+                h = mem_heap_create();
+                srand(1);
+                t_alloc[mode] = 0;
+                t_free[mode] = 0;
+                for (round = 0; round < rounds; round++)
+                {
+                    start = clock();
+                    if (mode == 0)
+                    {
+                        for (i = 0; i < n; i++)
+                        {
+                            ptrs[i] = mem_heap_alloc(h, sizes[s]);
+                        }
+                    }
+                    else
+                    {
+                        mem_heap_alloc_batch(h, sizes[s], n, ptrs);
+                    }
+                    t_alloc[mode] += bench_seconds(start);
+                    shuffle(ptrs, n);
+                    start = clock();
+                    if (mode == 0)
+                    {
+                        for (i = 0; i < n; i++)
+                        {
+                            mem_heap_free(h, ptrs[i]);
+                        }
+                    }
+                    else
+                    {
+                        mem_heap_free_batch(h, ptrs, n);
+                    }
+                    t_free[mode] += bench_seconds(start);
+                }
+                mem_heap_destroy(h);
+            }
+            per_area = 1e9 / ((double)rounds * n);
+            printf("bench_batch: %4u bytes x %4u, alloc single %.1f batch "
+                "%.1f, free single %.1f batch %.1f ns/area\n", sizes[s], n,
+                t_alloc[0] * per_area, t_alloc[1] * per_area,
+                t_free[0] * per_area, t_free[1] * per_area);
+        }
+    }
+}
+
+
+/* a request loop: each round allocates a few areas and frees them all, so
+ * that without the lazy mode they are merged back into one item and split
+ * again at the next round
+ */
+void
+bench_lazy()
+{
+    static const unsigned int sizes[] = { 100, 1000, 10000 };
+    static const unsigned int lazy[] = { 0, BENCH_LAZY_MAX };
+    void *ptrs[BENCH_LAZY_ITEMS];
+    struct mem_stats stats;
+    struct mem_heap *h;
+    unsigned int s, l, round, i;
+    clock_t start;
+    double seconds;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        for (l = 0; l < 2; l++)
+        {
+            h = mem_heap_create();
+            mem_heap_set_lazy(h, lazy[l]);
+            start = clock();
+            for (round = 0; round < BENCH_LAZY_ROUNDS; round++)
+            {
+                for (i = 0; i < BENCH_LAZY_ITEMS; i++)
+                {
+                    ptrs[i] = mem_heap_alloc(h, sizes[s] + i % 2 * sizes[s]);
+                }
+                for (i = 0; i < BENCH_LAZY_ITEMS; i++)
+                {
+                    mem_heap_free(h, ptrs[i]);
+                }
+            }
+            seconds = bench_seconds(start);
+            mem_heap_stats(h, &stats);
+            printf("bench_lazy: %5u bytes, lazy %2u, %.1f ns/op, "
+                "%lu splits, %lu merges\n", sizes[s], lazy[l],
+                seconds * 1e9 / (2.0 * BENCH_LAZY_ROUNDS * BENCH_LAZY_ITEMS),
+                stats.splits, stats.merges);
+            mem_heap_destroy(h);
+        }
+    }
+}
+
+
+/* benchmark suite of make bench: each scenario runs on its own heap, so
+ * that the figures of mem_heap_stats belong to it, and prints one line
+ * of CSV, or one object of a JSON array
+ */
+
+struct suite_result {
+    const char *name;
+    unsigned long ops;
+    double seconds;
+};
+
+
+void
+suite_print(struct suite_result *r, struct mem_heap *h, int json, int first)
+{
+    struct mem_stats stats;
+    mem_heap_stats(h, &stats);
+    printf(json ? "%s  {\"benchmark\": \"%s\", \"ops\": %lu, "
+            "\"seconds\": %.6f, \"ns_per_op\": %.2f, \"requested\": %llu, "
+            "\"handed_out\": %llu, \"held_bytes\": %lu, \"splits\": %lu, "
+            "\"merges\": %lu}"
+            : "%s%s,%lu,%.6f,%.2f,%llu,%llu,%lu,%lu,%lu\n",
+        json ? (first ? "[\n" : ",\n") : "", r->name, r->ops, r->seconds,
+        r->seconds * 1e9 / (double)r->ops,
+        (unsigned long long)stats.requested,
+        (unsigned long long)stats.handed_out,
+        (unsigned long)stats.chunk_bytes, stats.splits, stats.merges);
+}
+
+
+/* replaces random blocks among live ones, the sizes come from sizes[] */
+double
+suite_churn(struct mem_heap *h, unsigned int *sizes, unsigned int n_sizes)
+{
+    static void *live[SUITE_LIVE];
+    unsigned int i, k;
+    clock_t start;
+    for (i = 0; i < SUITE_LIVE; i++)
+    {
+        live[i] = mem_heap_alloc(h, sizes[i % n_sizes]);
+    }
+    start = clock();
+    for (k = 0; k < SUITE_OPS / 2; k++)
+    {
+        i = (unsigned int)rand() % SUITE_LIVE;
+        mem_heap_free(h, live[i]);
+        live[i] = mem_heap_alloc(h, sizes[k % n_sizes]);
+    }
+    return bench_seconds(start);
+}
+
+
+/* the same size again and again */
+double
+suite_same_size(struct mem_heap *h)
+{
+    unsigned int size = SUITE_CHURN_SIZE;
+    return suite_churn(h, &size, 1);
+}
+
+
+/* sizes one byte bigger than an item of a class, header included, which
+ * are rounded up to the next class: the worst case for the rounding
+ */
+double
+suite_boundary(struct mem_heap *h)
+{
+    static struct mem_stats stats;
+    unsigned int sizes[MEM_STATS_CLASSES];
+    unsigned int i, n = 0;
+    mem_heap_stats(h, &stats);
+    for (i = 0; i < stats.classes && stats.cls[i].size < SUITE_BOUNDARY_MAX;
+        i++)
+    {
+        sizes[n++] = (unsigned int)(stats.cls[i].size - sizeof(void*) + 1);
+    }
+    return suite_churn(h, sizes, n);
+}
+
+
+/* a queue: the producer allocates at the tail and the consumer frees the
+ * oldest block at the head
+ */
+double
+suite_producer_consumer(struct mem_heap *h)
+{
+    static void *queue[SUITE_LIVE];
+    unsigned int k, head;
+    clock_t start;
+    for (k = 0; k < SUITE_LIVE; k++)
+    {
+        queue[k] = mem_heap_alloc(h, (unsigned int)rand() % SUITE_MAX_SMALL
+                + 1);
+    }
+    start = clock();
+    for (k = 0; k < SUITE_OPS / 2; k++)
+    {
+        head = k % SUITE_LIVE;
+        mem_heap_free(h, queue[head]);
+        queue[head] = mem_heap_alloc(h, (unsigned int)rand()
+                % SUITE_MAX_SMALL + 1);
+    }
+    return bench_seconds(start);
+}
+
+
+/* allocates blocks of random sizes and frees them in order: 0 LIFO, 1
+ * FIFO, 2 random
+ */
+double
+suite_free_order(struct mem_heap *h, int order)
+{
+    static void *ptrs[SUITE_ORDER_BLOCKS];
+    unsigned int round, i;
+    clock_t start;
+    double seconds = 0;
+    for (round = 0; round < SUITE_ORDER_ROUNDS; round++)
+    {
+        start = clock();
+        for (i = 0; i < SUITE_ORDER_BLOCKS; i++)
+        {
+            ptrs[i] = mem_heap_alloc(h, (unsigned int)rand()
+                    % SUITE_MAX_SMALL + 1);
+        }
+        seconds += bench_seconds(start);
+        if (order == 2)
+        {
+            shuffle(ptrs, SUITE_ORDER_BLOCKS);
+        }
+        start = clock();
+        for (i = 0; i < SUITE_ORDER_BLOCKS; i++)
+        {
+            mem_heap_free(h, ptrs[order == 0 ? SUITE_ORDER_BLOCKS - 1 - i
+                    : i]);
+        }
+        seconds += bench_seconds(start);
+    }
+    return seconds;
+}
+
+
+/* a big block is allocated and freed, then small blocks split it all the
+ * way down and their frees merge it back up
+ */
+double
+suite_storm(struct mem_heap *h)
+{
+    static void *ptrs[SUITE_STORM_SMALL];
+    unsigned int round, i;
+    clock_t start = clock();
+    for (round = 0; round < SUITE_STORM_ROUNDS; round++)
+    {
+        mem_heap_free(h, mem_heap_alloc(h, SUITE_STORM_BIG));
+        for (i = 0; i < SUITE_STORM_SMALL; i++)
+        {
+            ptrs[i] = mem_heap_alloc(h, (unsigned int)rand() % 256 + 1);
+        }
+        for (i = 0; i < SUITE_STORM_SMALL; i++)
+        {
+            mem_heap_free(h, ptrs[i]);
+        }
+    }
+    return bench_seconds(start);
+}
+
+
+/* the mix of test_random: sizes from 1 to MAXIMUM_ALLOC_SIZE */
+double
+suite_random_mix(struct mem_heap *h)
+{
+    static void *array[ARRAY_SIZE];
+    unsigned int i, k;
+    clock_t start = clock();
+    for (k = 0; k < SUITE_MIX_OPS; k++)
+    {
+        i = (unsigned int)rand() % ARRAY_SIZE;
+        if (array[i] == NULL)
+        {
+            array[i] = mem_heap_alloc(h, (unsigned int)(rand()
+                    % MAXIMUM_ALLOC_SIZE) + 1);
+        }
+        else
+        {
+            mem_heap_free(h, array[i]);
+            array[i] = NULL;
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE; i++)
+    {
+        if (array[i] != NULL)
+        {
+            mem_heap_free(h, array[i]);
+            array[i] = NULL;
+        }
+    }
+    return bench_seconds(start);
+}
+
+
+double
+suite_free_lifo(struct mem_heap *h)
+{
+    return suite_free_order(h, 0);
+}
+
+
+double
+suite_free_fifo(struct mem_heap *h)
+{
+    return suite_free_order(h, 1);
+}
+
+
+double
+suite_free_random(struct mem_heap *h)
+{
+    return suite_free_order(h, 2);
+}
+
+
+void
+bench_suite(int json)
+{
+    static const struct {
+        const char *name;
+        unsigned long ops;
+        double (*run)(struct mem_heap *h);
+    } scenarios[] = {
+        { "same_size_churn", SUITE_OPS, suite_same_size },
+        { "fib_boundary", SUITE_OPS, suite_boundary },
+        { "producer_consumer", SUITE_OPS, suite_producer_consumer },
+        { "free_lifo", 2ul * SUITE_ORDER_BLOCKS * SUITE_ORDER_ROUNDS,
+            suite_free_lifo },
+        { "free_fifo", 2ul * SUITE_ORDER_BLOCKS * SUITE_ORDER_ROUNDS,
+            suite_free_fifo },
+        { "free_random", 2ul * SUITE_ORDER_BLOCKS * SUITE_ORDER_ROUNDS,
+            suite_free_random },
+        { "split_coalesce_storm",
+            SUITE_STORM_ROUNDS * (2ul + 2ul * SUITE_STORM_SMALL),
+            suite_storm },
+        { "random_mix", SUITE_MIX_OPS, suite_random_mix }
+    };
+    struct suite_result r;
+    struct mem_heap *h;
+    unsigned int i;
+
+    if (!json)
+    {
+        printf("benchmark,ops,seconds,ns_per_op,requested,handed_out,"
+            "held_bytes,splits,merges\n");
+    }
+    for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        srand(1);
+        h = mem_heap_create();
+        r.name = scenarios[i].name;
+        r.ops = scenarios[i].ops;
+        r.seconds = scenarios[i].run(h);
+        suite_print(&r, h, json, i == 0);
+        mem_heap_destroy(h);
+    }
+    if (json)
+    {
+        printf("\n]\n");
+    }
+}
+
+#if MEM_ALLOC_THREADS
+
+/* each thread keeps a few live blocks and replaces a random one at each
+ * step, so that the allocations and the frees are paired
+ */
+void*
+bench_thread(void *arg)
+{
+    void *slots[BENCH_MT_SLOTS];
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    unsigned int i, k;
+    for (i = 0; i < BENCH_MT_SLOTS; i++)
+    {
+        slots[i] = NULL;
+    }
+    for (k = 0; k < BENCH_MT_PAIRS; k++)
+    {
+        i = (unsigned int)rand_r(&seed) % BENCH_MT_SLOTS;
+        if (slots[i] != NULL)
+        {
+            mem_free(slots[i]);
+        }
+        slots[i] = mem_alloc((unsigned int)rand_r(&seed)
+                % BENCH_MT_MAX_SIZE + 1);
+    }
+    for (i = 0; i < BENCH_MT_SLOTS; i++)
+    {
+        if (slots[i] != NULL)
+        {
+            mem_free(slots[i]);
+        }
+    }
+    return NULL;
+}
+
+
+/* alloc/free pairs per second from 1 to max_threads threads */
+void
+bench_threads(unsigned int max_threads)
+{
+    pthread_t threads[BENCH_MT_THREADS];
+    struct timeval start, end;
+    unsigned int n, i;
+    double seconds;
+    if (max_threads > BENCH_MT_THREADS)
+    {
+        max_threads = BENCH_MT_THREADS;
+    }
+    for (n = 1; n <= max_threads; n++)
+    {
+        gettimeofday(&start, NULL);
+        for (i = 0; i < n; i++)
+        {
+            pthread_create(&threads[i], NULL, bench_thread,
+                (void*)(uintptr_t)(i + 1));
+        }
+        for (i = 0; i < n; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        gettimeofday(&end, NULL);
+        seconds = (double)(end.tv_sec - start.tv_sec)
+            + (double)(end.tv_usec - start.tv_usec) / 1e6;
+        printf("bench_threads: %u threads, %.0f pairs/s\n",
+            n, n * (double)BENCH_MT_PAIRS / seconds);
+    }
+}
+
+#endif /* MEM_ALLOC_THREADS */
+
+
+int
+main(int argc, char **argv)
+{
+    mem_init();
+
+    if (argc > 1)
+    {
+        if (strcmp(argv[1], "bench_free") == 0)
+        {
+            bench_free();
+        }
+        else if (strcmp(argv[1], "bench_free_same") == 0)
+        {
+            bench_free_same();
+        }
+        else if (strcmp(argv[1], "bench_batch") == 0)
+        {
+            bench_batch();
+        }
+        else if (strcmp(argv[1], "bench_lazy") == 0)
+        {
+            bench_lazy();
+        }
+        else if (strcmp(argv[1], "bench_suite") == 0)
+        {
+            bench_suite(argc > 2 && strcmp(argv[2], "json") == 0);
+        }
+#if MEM_ALLOC_THREADS
+        else if (strcmp(argv[1], "bench_threads") == 0)
+        {
+            bench_threads(argc > 2 ? (unsigned int)atoi(argv[2])
+                    : BENCH_MT_THREADS);
+        }
+#endif
+        mem_finalize();
+        return 0;
+    }
 
 //    test_1();
 //    test_2();
@@ -283,6 +1716,26 @@ main(int argc, char **argv)
 //    test_splitting();
 //    test_coalescing();
 //    test_unsplittable();
+    test_heaps();
+    test_trim();
+    test_growth();
+    test_realloc();
+    test_trace();
+    test_stats();
+    test_aligned();
+    test_slabs();
+    test_free_sized();
+    test_batch();
+    test_lazy();
+    test_huge();
+    test_check();
+    test_heap_of();
+#if MEM_ALLOC_THREADS
+    test_fork();
+#endif
+#if MEM_ALLOC_HARDEN
+    test_harden();
+#endif
     test_random();
 //    test_random_gen1();
 //    test_random_gen2();
@@ -0,0 +1,73 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/****h* mem_alloc/trace
+ *  NAME
+ *    trace - binary trace of allocations
+ *  DESCRIPTION
+ *    A trace file is a struct trace_header followed by count records.  A
+ *    record names the area by a slot number instead of its address, so
+ *    that the trace can be replayed with any allocator: an alloc puts the
+ *    new area into the slot, a free empties it, and a realloc replaces it.
+ *    slots is the number of slots used by the trace.  The integers are
+ *    written in the byte order of the machine.  The version 1 had sizes
+ *    of 32 bits, and is not read anymore.
+ *
+ *    test_random writes the file out.trace, and mem_replay -c converts a
+ *    ring dumped by mem_trace_dump.  mem_replay replays a trace.
+ ******
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TRACE_MAGIC "MEMTRACE"
+#define TRACE_VERSION 2
+
+#define TRACE_ALLOC 1
+#define TRACE_FREE 2
+#define TRACE_REALLOC 3
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t slots;
+    uint64_t count;
+};
+
+struct trace_record {
+    uint32_t op;
+    uint32_t slot;
+    uint64_t size;              /* bytes, 0 for free */
+};
+
+
+/* writes the header, again at the end when slots and count are known */
+static inline int
+trace_write_header(FILE *f, uint32_t slots, uint64_t count)
+{
+    struct trace_header header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.slots = slots;
+    header.count = count;
+    if (fseek(f, 0, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+    return fwrite(&header, sizeof(header), 1, f) == 1 ? 0 : -1;
+}
+
+
+static inline int
+trace_write(FILE *f, uint32_t op, uint32_t slot, uint64_t size)
+{
+    struct trace_record record;
+    record.op = op;
+    record.slot = slot;
+    record.size = size;
+    return fwrite(&record, sizeof(record), 1, f) == 1 ? 0 : -1;
+}
+
+#endif /* TRACE_H */